@@ -0,0 +1,126 @@
+#ifndef QUICKSVG_DETAIL_BINARY_IO_HPP
+#define QUICKSVG_DETAIL_BINARY_IO_HPP
+
+#include <cmath>
+#include <cstdint>
+#include <istream>
+#include <limits>
+#include <ostream>
+#include <string>
+#include <type_traits>
+
+namespace quicksvg { namespace detail {
+
+// Little helpers for the compact binary files (e.g. the ulp_plot cache).
+// Integers are stored in host byte order; the files are caches, not an interchange format.
+
+template<class T>
+void write_pod(std::ostream & os, T const & t)
+{
+    static_assert(std::is_trivially_copyable_v<T>, "write_pod requires a trivially copyable type");
+    os.write(reinterpret_cast<char const *>(&t), sizeof(T));
+}
+
+template<class T>
+bool read_pod(std::istream & is, T & t)
+{
+    static_assert(std::is_trivially_copyable_v<T>, "read_pod requires a trivially copyable type");
+    return static_cast<bool>(is.read(reinterpret_cast<char *>(&t), sizeof(T)));
+}
+
+inline void write_string(std::ostream & os, std::string const & s)
+{
+    write_pod(os, static_cast<std::uint64_t>(s.size()));
+    os.write(s.data(), s.size());
+}
+
+inline bool read_string(std::istream & is, std::string & s)
+{
+    std::uint64_t n;
+    if (!read_pod(is, n) || n > (std::uint64_t(1) << 20))
+    {
+        return false;
+    }
+    s.resize(n);
+    return static_cast<bool>(is.read(&s[0], n));
+}
+
+// Multiprecision types are generally not trivially copyable, so a Real is stored exactly as
+// a flag byte, a binary exponent, and its significand in 32 bit words (most significant first).
+template<class Real>
+void write_real(std::ostream & os, Real x)
+{
+    using std::abs;
+    using std::frexp;
+    using std::isnan;
+    using std::isinf;
+    using std::ldexp;
+    using std::floor;
+    constexpr int words = (std::numeric_limits<Real>::digits + 31)/32;
+    static_assert(std::numeric_limits<Real>::radix == 2, "write_real requires a binary floating point type");
+    // flags: bit 0 = negative, bit 1 = nan, bit 2 = infinity.
+    std::uint8_t flags = (x < 0) ? 1 : 0;
+    if (isnan(x))
+    {
+        flags = 2;
+    }
+    else if (isinf(x))
+    {
+        flags |= 4;
+    }
+    write_pod(os, flags);
+    int e = 0;
+    Real m = 0;
+    if (flags < 2)
+    {
+        m = frexp(abs(x), &e);
+    }
+    write_pod(os, static_cast<std::int32_t>(e));
+    for (int i = 0; i < words; ++i)
+    {
+        m = ldexp(m, 32);
+        Real w = floor(m);
+        write_pod(os, static_cast<std::uint32_t>(w));
+        m -= w;
+    }
+}
+
+template<class Real>
+bool read_real(std::istream & is, Real & x)
+{
+    using std::ldexp;
+    constexpr int words = (std::numeric_limits<Real>::digits + 31)/32;
+    std::uint8_t flags;
+    std::int32_t e;
+    std::uint32_t w[words];
+    if (!read_pod(is, flags) || !read_pod(is, e) || !is.read(reinterpret_cast<char *>(w), sizeof(w)))
+    {
+        return false;
+    }
+    if (flags & 2)
+    {
+        x = std::numeric_limits<Real>::quiet_NaN();
+        return true;
+    }
+    if (flags & 4)
+    {
+        x = std::numeric_limits<Real>::infinity();
+    }
+    else
+    {
+        Real m = 0;
+        for (int i = words - 1; i >= 0; --i)
+        {
+            m = ldexp(m + Real(w[i]), -32);
+        }
+        x = ldexp(m, e);
+    }
+    if (flags & 1)
+    {
+        x = -x;
+    }
+    return true;
+}
+
+}}
+#endif
@@ -0,0 +1,118 @@
+#ifndef QUICKSVG_DETAIL_CANVAS_HPP
+#define QUICKSVG_DETAIL_CANVAS_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "generic_svg_functionality.hpp"
+#include "png.hpp"
+
+namespace quicksvg { namespace detail {
+
+// HTML output: the plot's SVG (axes, gridlines, labels) inline in a page, with the datasets stored as
+// base64 Float32 arrays of screen coordinates and drawn onto a <canvas> over the SVG by a small script
+// when the page is viewed. That's about 5 bytes per coordinate, where a <circle> costs tens of bytes per point,
+// and no per-point elements for the browser to lay out.
+
+class canvas_layers
+{
+public:
+    // Stores values as a Float32 array and returns its index; NaN values are skipped when drawing.
+    size_t add_array(double const * values, size_t n)
+    {
+        std::string bytes(4*n, '\0');
+        for (size_t i = 0; i < n; ++i)
+        {
+            float f = static_cast<float>(values[i]);
+            std::uint32_t u;
+            std::memcpy(&u, &f, 4);
+            // Little-endian, which is what Float32Array reads on every browser platform:
+            for (int k = 0; k < 4; ++k)
+            {
+                bytes[4*i + k] = static_cast<char>((u >> (8*k)) & 0xFF);
+            }
+        }
+        m_arrays.push_back(base64(bytes));
+        return m_arrays.size() - 1;
+    }
+
+    // Draws the points (x0 + k*dx, ys[k]).
+    void add_series(size_t ys, double x0, double dx, std::string const & color, double width, bool line)
+    {
+        add_layer(ys, -1, x0, dx, color, width, line);
+    }
+
+    // Draws the points (xs[k], ys[k]).
+    void add_points(size_t xs, size_t ys, std::string const & color, double width, bool line)
+    {
+        add_layer(ys, static_cast<long>(xs), 0, 0, color, width, line);
+    }
+
+    // The page showing svg with the layers drawn over its graph area, whose origin is at (margin_left, margin_top).
+    // Lines are stroked with the given width; points are discs of radius width.
+    std::string html(std::string_view svg, int width, int height, int margin_left, int margin_top) const
+    {
+        std::string overlay = "<canvas width='" + std::to_string(width) + "' height='" + std::to_string(height)
+                            + "' style='position:absolute; left:0; top:0; pointer-events:none'></canvas>\n<script>\n(function(){\n"
+                              "var canvas = document.currentScript.previousElementSibling;\n"
+                              "var g = canvas.getContext('2d');\n"
+                              "g.translate(" + std::to_string(margin_left) + ", " + std::to_string(margin_top) + ");\n"
+                              "var arrays = [\n";
+        for (auto const & a : m_arrays)
+        {
+            overlay += "'" + a + "',\n";
+        }
+        overlay += "].map(function(s){ var b = atob(s), u = new Uint8Array(b.length);\n"
+                   "  for (var i = 0; i < b.length; ++i) { u[i] = b.charCodeAt(i); }\n"
+                   "  return new Float32Array(u.buffer); });\n"
+                   "var layers = [\n";
+        overlay += m_layers;
+        overlay += "];\n"
+                   "layers.forEach(function(l){\n"
+                   "  var y = arrays[l.y], xs = l.x >= 0 ? arrays[l.x] : null, pen = false;\n"
+                   "  g.strokeStyle = g.fillStyle = l.c; g.lineWidth = l.w; g.lineJoin = 'round';\n"
+                   "  g.beginPath();\n"
+                   "  for (var k = 0; k < y.length; ++k) {\n"
+                   "    var x = xs ? xs[k] : l.x0 + k*l.dx;\n"
+                   "    if (x !== x || y[k] !== y[k]) { pen = false; continue; }\n"
+                   "    if (!l.l) { g.moveTo(x + l.w, y[k]); g.arc(x, y[k], l.w, 0, 2*Math.PI); }\n"
+                   "    else if (pen) { g.lineTo(x, y[k]); }\n"
+                   "    else { g.moveTo(x, y[k]); pen = true; }\n"
+                   "  }\n"
+                   "  if (l.l) { g.stroke(); } else { g.fill(); }\n"
+                   "});\n"
+                   "})();\n</script>\n";
+        return html_page(svg, overlay);
+    }
+
+private:
+    void add_layer(size_t ys, long xs, double x0, double dx, std::string const & color, double width, bool line)
+    {
+        auto number = [](double v)
+        {
+            char s[32];
+            int n = std::snprintf(s, sizeof(s), "%.17g", v);
+            return std::string(s, n);
+        };
+        m_layers += "{y:" + std::to_string(ys) + ", x:" + std::to_string(xs) + ", x0:" + number(x0)
+                  + ", dx:" + number(dx) + ", w:" + number(width) + ", l:" + (line ? "1" : "0") + ", c:'";
+        // Colors are CSS color names or #hex/rgb() values; anything that could end the string literal is dropped.
+        for (char c : color)
+        {
+            if (c != '\'' && c != '\\' && c != '<' && c != '\n')
+            {
+                m_layers.push_back(c);
+            }
+        }
+        m_layers += "'},\n";
+    }
+
+    std::vector<std::string> m_arrays;
+    std::string m_layers;
+};
+
+}}
+#endif
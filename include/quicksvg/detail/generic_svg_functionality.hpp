@@ -1,15 +1,596 @@
 #ifndef QUICKSVG_DETAIL_GENERIC_SVG_FUNCTIONALITY
 #define QUICKSVG_DETAIL_GENERIC_SVG_FUNCTIONALITY
 
-#include <iomanip>
-#include <fstream>
+#include <algorithm>
+#include <charconv>
+#include <clocale>
 #include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#if defined __has_include
+#  if __has_include(<unistd.h>)
+#    include <unistd.h>
+#    define QUICKSVG_HAS_FSYNC
+#  endif
+#endif
+#include "kernels.hpp"
 
 namespace quicksvg { namespace detail {
 
-void write_prelude(std::ofstream& fs, std::string const & title, int width, int height, int margin_top)
+inline bool is_html(std::string const & filename)
+{
+    std::string_view suffix = ".html";
+    return filename.size() >= suffix.size() && filename.compare(filename.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// svg (which may start with an XML declaration) inline in an HTML page, followed by overlay.
+inline std::string html_page(std::string_view svg, std::string_view overlay = {})
+{
+    size_t start = svg.find("<svg");
+    svg = svg.substr(start == std::string_view::npos ? 0 : start);
+    std::string page = "<!DOCTYPE html>\n<html>\n<head><meta charset='UTF-8'></head>\n"
+                       "<body style='margin:0; background-color:black'>\n<div style='position:relative; display:inline-block'>\n";
+    page.append(svg.data(), svg.size());
+    page += overlay;
+    page += "</div>\n</body>\n</html>\n";
+    return page;
+}
+
+// Takes a plot over from an svg_buffer as it is written, for output formats other than SVG text (bitmaps):
+// the buffer hands over its elements as soon as they are complete, and paths as batches of their points.
+class svg_sink
+{
+public:
+    virtual ~svg_sink() = default;
+
+    // Takes the complete elements at the front of svg, and returns the number of characters they span.
+    virtual size_t consume(std::string_view svg) = 0;
+
+    // A <path> arrives as begin_path, any number of batches of its screen points, and end_path.
+    // A batch is (x, y) pairs and is joined to the next one by a segment; a (NaN, NaN) pair starts a new subpath.
+    virtual void begin_path(std::string_view stroke, double stroke_width, std::string_view extra_attributes) = 0;
+    virtual void path_points(std::vector<double> const & xy) = 0;
+    virtual void end_path() = 0;
+
+    // Forgets the plot drawn so far, keeping its storage for the next one.
+    virtual void clear() = 0;
+
+    virtual void write(std::string const & filename) = 0;
+};
+
+// A number printed with a fixed count of significant digits, as std::setprecision does for axis labels.
+template<class Real>
+struct significant_digits
+{
+    Real value;
+    int digits;
+};
+
+// The SVG is serialized into this buffer and written to disk in one step by write_to,
+// so an exception part way through a plot never leaves a partial file behind.
+// Coordinates are printed with std::to_chars at a fixed number of decimals (trailing zeros dropped).
+// With a sink, the text only lasts until its elements are complete, and write_to has the sink write the file.
+class svg_buffer
+{
+public:
+    svg_buffer() : m_precision{3} {}
+
+    void set_precision(int decimals)
+    {
+        if (decimals < 0 || decimals > 17)
+        {
+            throw std::domain_error("Coordinate precision must be in [0, 17]; requested " + std::to_string(decimals));
+        }
+        m_precision = decimals;
+    }
+
+    int precision() const
+    {
+        return m_precision;
+    }
+
+    // Empties the buffer but keeps its capacity, so it can be refilled without reallocating; the same goes for the sink.
+    void clear()
+    {
+        m_buf.clear();
+        if (m_sink)
+        {
+            m_sink->clear();
+        }
+    }
+
+    // Hands everything written from now on to sink, until write_to; a null sink keeps the SVG text.
+    void set_sink(std::unique_ptr<svg_sink> sink)
+    {
+        m_sink = std::move(sink);
+    }
+
+    bool has_sink() const
+    {
+        return m_sink != nullptr;
+    }
+
+    // The text written so far; with a sink, only what it hasn't taken yet.
+    std::string const & str() const
+    {
+        return m_buf;
+    }
+
+    // See svg_sink; path_writer's output when there is a sink.
+    void begin_path(std::string_view stroke, double stroke_width, std::string_view extra_attributes)
+    {
+        flush();
+        m_sink->begin_path(stroke, stroke_width, extra_attributes);
+    }
+
+    void path_points(std::vector<double> const & xy)
+    {
+        m_sink->path_points(xy);
+    }
+
+    void end_path()
+    {
+        m_sink->end_path();
+    }
+
+    svg_buffer & operator<<(std::string_view s)
+    {
+        m_buf.append(s.data(), s.size());
+        if (m_sink && m_buf.size() >= sink_batch)
+        {
+            flush();
+        }
+        return *this;
+    }
+
+    svg_buffer & operator<<(char const * s)
+    {
+        return *this << std::string_view(s);
+    }
+
+    svg_buffer & operator<<(std::string const & s)
+    {
+        return *this << std::string_view(s);
+    }
+
+    svg_buffer & operator<<(char c)
+    {
+        m_buf.push_back(c);
+        return *this;
+    }
+
+    template<class T, typename = std::enable_if_t<!std::is_convertible_v<T const &, std::string_view>>>
+    svg_buffer & operator<<(T const & x)
+    {
+        if constexpr (std::is_integral_v<T>)
+        {
+            char s[24];
+            auto result = std::to_chars(s, s + sizeof(s), x);
+            m_buf.append(s, result.ptr);
+        }
+        else
+        {
+            // Screen coordinates never need more than double; multiprecision types are converted first.
+            append_fixed(static_cast<double>(x));
+        }
+        return *this;
+    }
+
+    template<class Real>
+    svg_buffer & operator<<(significant_digits<Real> const & x)
+    {
+        char s[64];
+        double v = static_cast<double>(x.value);
+#ifdef __cpp_lib_to_chars
+        auto result = std::to_chars(s, s + sizeof(s), v, std::chars_format::general, x.digits);
+        m_buf.append(s, result.ptr);
+#else
+        int n = std::snprintf(s, sizeof(s), "%.*g", x.digits, v);
+        m_buf.append(s, c_decimal_point(s, s + std::min<int>(n, sizeof(s) - 1)));
+#endif
+        return *this;
+    }
+
+    // Writes through write_file. With a sink, the sink writes the file; otherwise a filename ending in .html
+    // gets the SVG inline in a web page.
+    void write_to(std::string const & filename)
+    {
+        if (m_sink)
+        {
+            flush();
+            m_sink->write(filename);
+            return;
+        }
+        if (is_html(filename))
+        {
+            write_file(filename, html_page(m_buf));
+            return;
+        }
+        write_file(filename, m_buf);
+    }
+
+    // Writes contents to a temporary file next to filename, flushes it to disk and renames it over filename.
+    // On POSIX the rename replaces filename atomically, so readers see either the old file or the new one;
+    // where rename refuses to replace an existing file, this throws rather than remove filename first.
+    static void write_file(std::string const & filename, std::string_view contents)
+    {
+        // A random suffix, so that processes or threads writing the same file don't share a temporary:
+        std::random_device random;
+        char suffix[24];
+        std::snprintf(suffix, sizeof(suffix), ".%08x%08x.tmp", unsigned(random()), unsigned(random()));
+        std::string tmp = filename + suffix;
+        std::FILE* fp = std::fopen(tmp.c_str(), "wb");
+        if (!fp)
+        {
+            throw std::runtime_error("Could not open " + tmp);
+        }
+        bool written = std::fwrite(contents.data(), 1, contents.size(), fp) == contents.size()
+                       && std::fflush(fp) == 0;
+#ifdef QUICKSVG_HAS_FSYNC
+        // Otherwise a crash after the rename can leave filename empty:
+        written = written && ::fsync(::fileno(fp)) == 0;
+#endif
+        written = std::fclose(fp) == 0 && written;
+        if (!written)
+        {
+            std::remove(tmp.c_str());
+            throw std::runtime_error("Could not write " + tmp);
+        }
+        if (std::rename(tmp.c_str(), filename.c_str()) != 0)
+        {
+            std::remove(tmp.c_str());
+            throw std::runtime_error("Could not rename " + tmp + " to " + filename);
+        }
+    }
+
+private:
+    // Text is handed to a sink in batches of about this many characters:
+    static constexpr size_t sink_batch = 1 << 16;
+
+    void flush()
+    {
+        m_buf.erase(0, m_sink->consume(m_buf));
+    }
+
+    // snprintf writes the decimal point of the C library's locale, which may be ','; SVG needs '.'.
+    // Returns the new end of [s, end).
+    static char * c_decimal_point(char * s, char * end)
+    {
+        char const * point = std::localeconv()->decimal_point;
+        size_t n = std::strlen(point);
+        if (n == 0 || (n == 1 && point[0] == '.'))
+        {
+            return end;
+        }
+        char * p = std::search(s, end, point, point + n);
+        if (p == end)
+        {
+            return end;
+        }
+        *p = '.';
+        return std::copy(p + n, end, p + 1);
+    }
+
+    void append_fixed(double v)
+    {
+        char s[64];
+        char * end;
+#ifdef __cpp_lib_to_chars
+        auto result = std::to_chars(s, s + sizeof(s), v, std::chars_format::fixed, m_precision);
+        if (result.ec != std::errc())
+        {
+            // Absurdly large values don't fit; they aren't on screen anyway.
+            result = std::to_chars(s, s + sizeof(s), v);
+        }
+        end = result.ptr;
+#else
+        int n = std::snprintf(s, sizeof(s), "%.*f", m_precision, v);
+        end = c_decimal_point(s, s + std::min<int>(n, sizeof(s) - 1));
+#endif
+        if (m_precision > 0 && std::find(s, end, '.') != end && std::find(s, end, 'e') == end)
+        {
+            while (end[-1] == '0')
+            {
+                --end;
+            }
+            if (end[-1] == '.')
+            {
+                --end;
+            }
+        }
+        if (end - s == 2 && s[0] == '-' && s[1] == '0')
+        {
+            m_buf.push_back('0');
+            return;
+        }
+        m_buf.append(s, end);
+    }
+
+    std::string m_buf;
+    int m_precision;
+    std::unique_ptr<svg_sink> m_sink;
+};
+
+// Writes <path> elements point by point.
+// By default coordinates are absolute ("M x y L x y ..."), as plain as SVG gets.
+// In compact mode each coordinate is multiplied by subpixels and rounded to an integer,
+// points are encoded relative to their predecessor with l/h/v (repeated commands and
+// separators in front of minus signs are dropped), and the element is scaled back by transform='scale(1/subpixels)'.
+// For dense paths this is several times smaller than absolute coordinates, at no visible cost.
+// If the buffer has a sink, the points are handed to it in batches instead,
+// so a path of any length takes a fixed amount of memory.
+// Every path written is stroked with stroke, stroke_width and extra_attributes, which is copied verbatim into the element.
+class path_writer
+{
+public:
+    path_writer(svg_buffer & svg, bool compact, std::string stroke, double stroke_width,
+                std::string extra_attributes = "", int subpixels = 10) :
+        m_svg{svg},
+        m_compact{compact},
+        m_points_only{svg.has_sink()},
+        m_stroke{std::move(stroke)},
+        m_stroke_width{stroke_width},
+        m_extra_attributes{std::move(extra_attributes)},
+        m_subpixels{subpixels},
+        m_open{false}
+    {}
+
+    // Coordinates of any real type are accepted; they're converted to double, which is plenty for screen space.
+    template<class X, class Y>
+    void move_to(X x_, Y y_)
+    {
+        double x = static_cast<double>(x_);
+        double y = static_cast<double>(y_);
+        if (m_points_only)
+        {
+            if (m_open)
+            {
+                point(std::numeric_limits<double>::quiet_NaN(), std::numeric_limits<double>::quiet_NaN());
+            }
+            else
+            {
+                m_svg.begin_path(m_stroke, m_stroke_width, m_extra_attributes);
+                m_open = true;
+            }
+            point(x, y);
+            return;
+        }
+        if (!m_open)
+        {
+            m_svg << "<path ";
+            if (m_compact)
+            {
+                m_svg << "transform='scale(" << 1.0/m_subpixels << ")' ";
+            }
+            m_svg << "d='";
+            m_open = true;
+            m_implicit = '\0';
+            m_x = 0;
+            m_y = 0;
+        }
+        else if (!m_compact)
+        {
+            m_svg << ' ';
+        }
+        if (!m_compact)
+        {
+            m_svg << 'M' << x << ' ' << y;
+            return;
+        }
+        // The first moveto of a path is absolute even when written as 'm', since we start from (0, 0):
+        long ix = std::lround(x*m_subpixels);
+        long iy = std::lround(y*m_subpixels);
+        command('m');
+        number(ix - m_x);
+        number(iy - m_y);
+        m_x = ix;
+        m_y = iy;
+        m_after_move = true;
+    }
+
+    template<class X, class Y>
+    void line_to(X x_, Y y_)
+    {
+        double x = static_cast<double>(x_);
+        double y = static_cast<double>(y_);
+        if (m_points_only)
+        {
+            point(x, y);
+            return;
+        }
+        if (!m_compact)
+        {
+            m_svg << " L" << x << ' ' << y;
+            return;
+        }
+        long ix = std::lround(x*m_subpixels);
+        long iy = std::lround(y*m_subpixels);
+        if (ix == m_x && iy == m_y && !m_after_move)
+        {
+            // Repeated points add nothing, except right after a move, where they draw a dot when the cap is round.
+            return;
+        }
+        if (iy == m_y)
+        {
+            command('h');
+            number(ix - m_x);
+        }
+        else if (ix == m_x)
+        {
+            command('v');
+            number(iy - m_y);
+        }
+        else
+        {
+            command('l');
+            number(ix - m_x);
+            number(iy - m_y);
+        }
+        m_x = ix;
+        m_y = iy;
+        m_after_move = false;
+    }
+
+    // A zero-length segment, which a round line cap turns into a dot of diameter stroke-width.
+    template<class X, class Y>
+    void dot(X x, Y y)
+    {
+        move_to(x, y);
+        if (m_compact || m_points_only)
+        {
+            line_to(x, y);
+        }
+        else
+        {
+            m_svg << "h0";
+        }
+    }
+
+    // Finishes the current path, if any; the next move_to starts another.
+    void close()
+    {
+        if (!m_open)
+        {
+            return;
+        }
+        m_open = false;
+        if (m_points_only)
+        {
+            m_svg.path_points(m_points);
+            m_points.clear();
+            m_svg.end_path();
+            return;
+        }
+        m_svg << "' stroke='" << m_stroke << "' stroke-width='" << (m_compact ? m_stroke_width*m_subpixels : m_stroke_width) << "' ";
+        if (m_extra_attributes.size() > 0)
+        {
+            m_svg << m_extra_attributes << ' ';
+        }
+        m_svg << "fill='none'></path>\n";
+    }
+
+private:
+    // Points are handed to the sink this many (x, y) pairs at a time:
+    static constexpr size_t points_batch = 1 << 12;
+
+    // Appends a point for the sink. A full batch is handed over, and its last point starts the next
+    // one, so the segment between them is drawn.
+    void point(double x, double y)
+    {
+        m_points.push_back(x);
+        m_points.push_back(y);
+        if (m_points.size() >= 2*points_batch)
+        {
+            m_svg.path_points(m_points);
+            m_points.erase(m_points.begin(), m_points.end() - 2);
+        }
+    }
+
+    // Numbers following a command repeat it (after a moveto, they are linetos), so the letter is only written when it changes.
+    void command(char c)
+    {
+        if (c != m_implicit)
+        {
+            m_svg << c;
+            m_separate = false;
+        }
+        m_implicit = (c == 'm') ? 'l' : c;
+    }
+
+    void number(long n)
+    {
+        if (m_separate && n >= 0)
+        {
+            m_svg << ' ';
+        }
+        m_svg << n;
+        m_separate = true;
+    }
+
+    svg_buffer & m_svg;
+    bool m_compact;
+    bool m_points_only;
+    std::string m_stroke;
+    double m_stroke_width;
+    std::string m_extra_attributes;
+    int m_subpixels;
+    bool m_open;
+    bool m_after_move = false;
+    bool m_separate = false;
+    char m_implicit = '\0';
+    long m_x = 0;
+    long m_y = 0;
+    // The (x, y) pairs not yet handed to the sink:
+    std::vector<double> m_points;
+};
+
+// The affine map from data space onto a pixel axis, evaluated in double.
+// Multiprecision data is converted once per value, rather than pushed through bignum arithmetic
+// only to be printed at a few decimals. If [lo, hi] is too narrow to resolve in double at its
+// magnitude, the offset x - lo is taken in Real first so that such plots don't collapse.
+template<class Real>
+class axis_map
+{
+public:
+    // Maps [lo, hi] onto [0, pixels], or onto [pixels, 0] when flipped (SVG y coordinates grow downwards).
+    axis_map(Real lo, Real hi, double pixels, bool flip = false) :
+        m_lo{lo},
+        m_lo_d{static_cast<double>(lo)},
+        m_offset{flip ? pixels : 0}
+    {
+        double hi_d = static_cast<double>(hi);
+        double magnitude = std::max(std::abs(m_lo_d), std::abs(hi_d));
+        m_exact = !(hi_d - m_lo_d > 1e6*std::numeric_limits<double>::epsilon()*magnitude);
+        double width = m_exact ? static_cast<double>(hi - lo) : hi_d - m_lo_d;
+        m_scale = (flip ? -pixels : pixels)/width;
+    }
+
+    double operator()(Real const & x) const
+    {
+        double d = m_exact ? static_cast<double>(x - m_lo) : static_cast<double>(x) - m_lo_d;
+        return m_offset + d*m_scale;
+    }
+
+    // Maps data[0], data[stride], ... into out[0, n) with the vectorized kernel where possible.
+    template<class T>
+    void transform(T const * data, size_t n, size_t stride, double * out) const
+    {
+        if (m_exact)
+        {
+            for (size_t i = 0; i < n; ++i)
+            {
+                out[i] = (*this)(static_cast<Real>(data[i*stride]));
+            }
+            return;
+        }
+        detail::affine(data, n, stride, m_lo_d, m_scale, m_offset, out);
+    }
+
+    // Pixels per unit of data; useful for evenly spaced samples, whose positions are then i*step*scale().
+    double scale() const
+    {
+        return std::abs(m_scale);
+    }
+
+private:
+    Real m_lo;
+    double m_lo_d;
+    double m_offset;
+    double m_scale;
+    bool m_exact;
+};
+
+inline void write_prelude(svg_buffer& fs, std::string const & title, int width, int height, int margin_top)
 {
-    using std::floor;
     fs << "<?xml version=\"1.0\" encoding='UTF-8' ?>\n"
        << "<svg xmlns='http://www.w3.org/2000/svg' width='"
        << width << "' height='"
@@ -20,27 +601,25 @@ void write_prelude(std::ofstream& fs, std::string const & title, int width, int
        // Title:
     if (title.size() > 0)
     {
-    fs << "<text x='" << floor(width/2)
-       << "' y='" << floor(margin_top/2)
+    fs << "<text x='" << width/2
+       << "' y='" << margin_top/2
        << "' font-family='Palatino' font-size='25' fill='white'  alignment-baseline='middle' text-anchor='middle'>"
        << title
        << "</text>\n";
     }
 }
 
-void write_xlabel(std::ofstream& fs, std::string const & x_label, int width, int height, int margin_bottom)
+inline void write_xlabel(svg_buffer& fs, std::string const & x_label, int width, int height, int margin_bottom)
 {
-    using std::floor;
-    fs << "<text x='" << floor(width/2)
-       << "' y='" << floor(height - margin_bottom/4)
+    fs << "<text x='" << width/2
+       << "' y='" << height - margin_bottom/4
        << "' font-family='Palatino' font-size='15' fill='white'  alignment-baseline='middle' text-anchor='middle'>"
        << x_label
        << "</text>\n";
 }
 
-void write_ylabel(std::ofstream& fs, std::string const & y_label, int width, int height, int margin_left)
+inline void write_ylabel(svg_buffer& fs, std::string const & y_label, int /*width*/, int height, int margin_left)
 {
-    using std::floor;
     fs << "<text x='0' y='0' font-family='Palatino' font-size='15' fill='white' alignment-baseline='middle' text-anchor='middle' transform='translate("
        << margin_left/4 << ", " << height/2 << ")rotate(-90)'>"
        << y_label
@@ -49,7 +628,7 @@ void write_ylabel(std::ofstream& fs, std::string const & y_label, int width, int
 
 
 template<class F1, class F2, class Real>
-void write_gridlines(std::ofstream& fs, int horizontal_lines, int vertical_lines,
+void write_gridlines(svg_buffer& fs, int horizontal_lines, int vertical_lines,
                      F1 x_scale, F2 y_scale, Real min_x, Real max_x, Real min_y, Real max_y,
                      int graph_width, int graph_height, int margin_left)
 {
@@ -64,19 +643,19 @@ void write_gridlines(std::ofstream& fs, int horizontal_lines, int vertical_lines
       fs << "<text x='" <<  -margin_left/4 + 5 << "' y='" << y - 3
          << "' font-family='times' font-size='10' fill='white' transform='rotate(-90 "
          << -margin_left/4 + 8 << " " << y + 5 << ")'>"
-         << std::setprecision(4) << y_cord_dataspace << "</text>\n";
+         << significant_digits<Real>{y_cord_dataspace, 4} << "</text>\n";
    }
 
    for (int i = 1; i <= vertical_lines; ++i) {
        Real x_cord_dataspace = min_x +  ((max_x - min_x)*i)/vertical_lines;
-       Real x = x_scale(x_cord_dataspace);
+       auto x = x_scale(x_cord_dataspace);
        fs << "<line x1='" << x << "' y1='0' x2='" << x
           << "' y2='" << graph_height
           << "' stroke='gray' stroke-width='1' opacity='0.5' stroke-dasharray='4' />\n";
 
         fs << "<text x='" <<  x - 10  << "' y='" << graph_height + 10
              << "' font-family='times' font-size='10' fill='white'>"
-             << std::setprecision(4) << x_cord_dataspace << "</text>\n";
+             << significant_digits<Real>{x_cord_dataspace, 4} << "</text>\n";
     }
 }
 
@@ -0,0 +1,241 @@
+#ifndef QUICKSVG_DETAIL_KERNELS_HPP
+#define QUICKSVG_DETAIL_KERNELS_HPP
+
+#include <algorithm>
+#include <cstddef>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace quicksvg { namespace detail {
+
+// Loops shared by all the plots: the min/max of the data and the map from data to screen coordinates.
+// The templates work for any Real (multiprecision included); float and double have vectorized
+// overloads when compiled with AVX2 or SSE2. Strided data (stride != 1) always takes the scalar path.
+
+// Widens [lo, hi] to include data[0], data[stride], ..., data[(n-1)*stride], skipping NaNs.
+template<class Real>
+void minmax(Real const * data, size_t n, size_t stride, Real & lo, Real & hi)
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        Real const & x = data[i*stride];
+        // Comparisons with NaN are false, so NaNs fall through:
+        if (x < lo)
+        {
+            lo = x;
+        }
+        if (x > hi)
+        {
+            hi = x;
+        }
+    }
+}
+
+// out[i] = offset + (data[i*stride] - origin)*scale, in double.
+template<class Real>
+void affine(Real const * data, size_t n, size_t stride, double origin, double scale, double offset, double * out)
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        out[i] = offset + (static_cast<double>(data[i*stride]) - origin)*scale;
+    }
+}
+
+#if defined(__AVX2__) || defined(__SSE2__)
+
+// Folds the lanes of the vector accumulators into lo and hi.
+template<class Real>
+void reduce_lanes(Real const * l, Real const * h, size_t lanes, Real & lo, Real & hi)
+{
+    for (size_t k = 0; k < lanes; ++k)
+    {
+        lo = std::min(lo, l[k]);
+        hi = std::max(hi, h[k]);
+    }
+}
+
+// x86 min/max return their second operand when either is NaN, so NaNs in x never reach the accumulator.
+#if defined(__AVX2__)
+inline void minmax(double const * data, size_t n, size_t stride, double & lo, double & hi)
+{
+    if (stride != 1)
+    {
+        minmax<double>(data, n, stride, lo, hi);
+        return;
+    }
+    size_t i = 0;
+    __m256d vlo = _mm256_set1_pd(lo);
+    __m256d vhi = _mm256_set1_pd(hi);
+    for (; i + 4 <= n; i += 4)
+    {
+        __m256d x = _mm256_loadu_pd(data + i);
+        vlo = _mm256_min_pd(x, vlo);
+        vhi = _mm256_max_pd(x, vhi);
+    }
+    double l[4];
+    double h[4];
+    _mm256_storeu_pd(l, vlo);
+    _mm256_storeu_pd(h, vhi);
+    reduce_lanes(l, h, 4, lo, hi);
+    minmax<double>(data + i, n - i, 1, lo, hi);
+}
+
+inline void minmax(float const * data, size_t n, size_t stride, float & lo, float & hi)
+{
+    if (stride != 1)
+    {
+        minmax<float>(data, n, stride, lo, hi);
+        return;
+    }
+    size_t i = 0;
+    __m256 vlo = _mm256_set1_ps(lo);
+    __m256 vhi = _mm256_set1_ps(hi);
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256 x = _mm256_loadu_ps(data + i);
+        vlo = _mm256_min_ps(x, vlo);
+        vhi = _mm256_max_ps(x, vhi);
+    }
+    float l[8];
+    float h[8];
+    _mm256_storeu_ps(l, vlo);
+    _mm256_storeu_ps(h, vhi);
+    reduce_lanes(l, h, 8, lo, hi);
+    minmax<float>(data + i, n - i, 1, lo, hi);
+}
+
+inline void affine(double const * data, size_t n, size_t stride, double origin, double scale, double offset, double * out)
+{
+    if (stride != 1)
+    {
+        affine<double>(data, n, stride, origin, scale, offset, out);
+        return;
+    }
+    size_t i = 0;
+    __m256d vorigin = _mm256_set1_pd(origin);
+    __m256d vscale = _mm256_set1_pd(scale);
+    __m256d voffset = _mm256_set1_pd(offset);
+    for (; i + 4 <= n; i += 4)
+    {
+        __m256d x = _mm256_loadu_pd(data + i);
+        _mm256_storeu_pd(out + i, _mm256_add_pd(voffset, _mm256_mul_pd(_mm256_sub_pd(x, vorigin), vscale)));
+    }
+    affine<double>(data + i, n - i, 1, origin, scale, offset, out + i);
+}
+
+inline void affine(float const * data, size_t n, size_t stride, double origin, double scale, double offset, double * out)
+{
+    if (stride != 1)
+    {
+        affine<float>(data, n, stride, origin, scale, offset, out);
+        return;
+    }
+    size_t i = 0;
+    __m256d vorigin = _mm256_set1_pd(origin);
+    __m256d vscale = _mm256_set1_pd(scale);
+    __m256d voffset = _mm256_set1_pd(offset);
+    for (; i + 4 <= n; i += 4)
+    {
+        __m256d x = _mm256_cvtps_pd(_mm_loadu_ps(data + i));
+        _mm256_storeu_pd(out + i, _mm256_add_pd(voffset, _mm256_mul_pd(_mm256_sub_pd(x, vorigin), vscale)));
+    }
+    affine<float>(data + i, n - i, 1, origin, scale, offset, out + i);
+}
+
+#else // SSE2
+
+inline void minmax(double const * data, size_t n, size_t stride, double & lo, double & hi)
+{
+    if (stride != 1)
+    {
+        minmax<double>(data, n, stride, lo, hi);
+        return;
+    }
+    size_t i = 0;
+    __m128d vlo = _mm_set1_pd(lo);
+    __m128d vhi = _mm_set1_pd(hi);
+    for (; i + 2 <= n; i += 2)
+    {
+        __m128d x = _mm_loadu_pd(data + i);
+        vlo = _mm_min_pd(x, vlo);
+        vhi = _mm_max_pd(x, vhi);
+    }
+    double l[2];
+    double h[2];
+    _mm_storeu_pd(l, vlo);
+    _mm_storeu_pd(h, vhi);
+    reduce_lanes(l, h, 2, lo, hi);
+    minmax<double>(data + i, n - i, 1, lo, hi);
+}
+
+inline void minmax(float const * data, size_t n, size_t stride, float & lo, float & hi)
+{
+    if (stride != 1)
+    {
+        minmax<float>(data, n, stride, lo, hi);
+        return;
+    }
+    size_t i = 0;
+    __m128 vlo = _mm_set1_ps(lo);
+    __m128 vhi = _mm_set1_ps(hi);
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128 x = _mm_loadu_ps(data + i);
+        vlo = _mm_min_ps(x, vlo);
+        vhi = _mm_max_ps(x, vhi);
+    }
+    float l[4];
+    float h[4];
+    _mm_storeu_ps(l, vlo);
+    _mm_storeu_ps(h, vhi);
+    reduce_lanes(l, h, 4, lo, hi);
+    minmax<float>(data + i, n - i, 1, lo, hi);
+}
+
+inline void affine(double const * data, size_t n, size_t stride, double origin, double scale, double offset, double * out)
+{
+    if (stride != 1)
+    {
+        affine<double>(data, n, stride, origin, scale, offset, out);
+        return;
+    }
+    size_t i = 0;
+    __m128d vorigin = _mm_set1_pd(origin);
+    __m128d vscale = _mm_set1_pd(scale);
+    __m128d voffset = _mm_set1_pd(offset);
+    for (; i + 2 <= n; i += 2)
+    {
+        __m128d x = _mm_loadu_pd(data + i);
+        _mm_storeu_pd(out + i, _mm_add_pd(voffset, _mm_mul_pd(_mm_sub_pd(x, vorigin), vscale)));
+    }
+    affine<double>(data + i, n - i, 1, origin, scale, offset, out + i);
+}
+
+inline void affine(float const * data, size_t n, size_t stride, double origin, double scale, double offset, double * out)
+{
+    if (stride != 1)
+    {
+        affine<float>(data, n, stride, origin, scale, offset, out);
+        return;
+    }
+    size_t i = 0;
+    __m128d vorigin = _mm_set1_pd(origin);
+    __m128d vscale = _mm_set1_pd(scale);
+    __m128d voffset = _mm_set1_pd(offset);
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128 x = _mm_loadu_ps(data + i);
+        __m128d x_lo = _mm_cvtps_pd(x);
+        __m128d x_hi = _mm_cvtps_pd(_mm_movehl_ps(x, x));
+        _mm_storeu_pd(out + i, _mm_add_pd(voffset, _mm_mul_pd(_mm_sub_pd(x_lo, vorigin), vscale)));
+        _mm_storeu_pd(out + i + 2, _mm_add_pd(voffset, _mm_mul_pd(_mm_sub_pd(x_hi, vorigin), vscale)));
+    }
+    affine<float>(data + i, n - i, 1, origin, scale, offset, out + i);
+}
+
+#endif
+#endif
+
+}}
+#endif
@@ -0,0 +1,124 @@
+#ifndef QUICKSVG_DETAIL_M4_HPP
+#define QUICKSVG_DETAIL_M4_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+namespace quicksvg { namespace detail {
+
+// M4 aggregation: within a pixel column, a line through the first, last, minimum and maximum samples
+// rasterizes to the same pixels as a line through every sample, so at most 4 samples per column are kept.
+// Samples must be added in index order, and columns must be nondecreasing in index.
+template<class Real>
+class m4_columns
+{
+public:
+    struct sample
+    {
+        size_t index;
+        Real value;
+    };
+
+    struct bucket
+    {
+        sample first;
+        sample min;
+        sample max;
+        sample last;
+        size_t count = 0;
+    };
+
+    explicit m4_columns(size_t columns) : m_buckets(columns) {}
+
+    void add(size_t column, size_t index, Real value)
+    {
+        bucket & b = m_buckets[column];
+        sample s{index, value};
+        if (b.count++ == 0)
+        {
+            b.first = s;
+            b.min = s;
+            b.max = s;
+        }
+        else if (value < b.min.value)
+        {
+            b.min = s;
+        }
+        else if (value > b.max.value)
+        {
+            b.max = s;
+        }
+        b.last = s;
+    }
+
+    // Folds b into column; b's samples must all come after those already in the column.
+    // Merging the buckets of adjacent columns gives exactly the bucket of the wider column.
+    void merge(size_t column, bucket const & b)
+    {
+        if (b.count == 0)
+        {
+            return;
+        }
+        bucket & a = m_buckets[column];
+        if (a.count == 0)
+        {
+            a = b;
+            return;
+        }
+        if (b.min.value < a.min.value)
+        {
+            a.min = b.min;
+        }
+        if (b.max.value > a.max.value)
+        {
+            a.max = b.max;
+        }
+        a.last = b.last;
+        a.count += b.count;
+    }
+
+    bucket const & operator[](size_t column) const
+    {
+        return m_buckets[column];
+    }
+
+    size_t size() const
+    {
+        return m_buckets.size();
+    }
+
+    // Empties every column, keeping the storage.
+    void clear()
+    {
+        std::fill(m_buckets.begin(), m_buckets.end(), bucket{});
+    }
+
+    // Calls f(index, value) for the retained samples, in index order and without repeats.
+    template<class F>
+    void for_each(F f) const
+    {
+        for (auto const & b : m_buckets)
+        {
+            if (b.count == 0)
+            {
+                continue;
+            }
+            sample s[4] = {b.first, b.min, b.max, b.last};
+            std::sort(s, s + 4, [](sample const & x, sample const & y) { return x.index < y.index; });
+            for (int k = 0; k < 4; ++k)
+            {
+                if (k == 0 || s[k].index != s[k-1].index)
+                {
+                    f(s[k].index, s[k].value);
+                }
+            }
+        }
+    }
+
+private:
+    std::vector<bucket> m_buckets;
+};
+
+}}
+#endif
@@ -0,0 +1,78 @@
+#ifndef QUICKSVG_DETAIL_PARALLEL_FOR_HPP
+#define QUICKSVG_DETAIL_PARALLEL_FOR_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <exception>
+#include <thread>
+#include <vector>
+
+namespace quicksvg { namespace detail {
+
+// A request for 0 threads means "use every hardware thread".
+inline unsigned thread_count(unsigned threads)
+{
+    if (threads == 0)
+    {
+        threads = std::thread::hardware_concurrency();
+    }
+    return std::max(threads, 1u);
+}
+
+// Number of chunks parallel_for splits [0, n) into.
+// Callers doing reductions allocate one accumulator per chunk and combine them in chunk order.
+inline size_t chunk_count(size_t n, unsigned threads)
+{
+    return std::max<size_t>(std::min<size_t>(n, thread_count(threads)), 1);
+}
+
+// Calls f(chunk, begin, end) on contiguous chunks of [0, n).
+// The partition depends only on n and threads, so the result is identical to the serial loop
+// as long as f writes to disjoint indices (or to per-chunk accumulators).
+// If any chunk throws, the exception of the lowest chunk is rethrown once every worker has joined.
+template<class F>
+void parallel_for(size_t n, unsigned threads, F f)
+{
+    size_t chunks = chunk_count(n, threads);
+    if (chunks == 1)
+    {
+        f(size_t(0), size_t(0), n);
+        return;
+    }
+
+    std::vector<std::exception_ptr> errors(chunks);
+    std::vector<std::thread> workers;
+    workers.reserve(chunks - 1);
+    auto run = [&](size_t chunk)
+    {
+        size_t begin = (n*chunk)/chunks;
+        size_t end = (n*(chunk + 1))/chunks;
+        try
+        {
+            f(chunk, begin, end);
+        }
+        catch (...)
+        {
+            errors[chunk] = std::current_exception();
+        }
+    };
+    for (size_t chunk = 1; chunk < chunks; ++chunk)
+    {
+        workers.emplace_back(run, chunk);
+    }
+    run(0);
+    for (auto & worker : workers)
+    {
+        worker.join();
+    }
+    for (auto const & e : errors)
+    {
+        if (e)
+        {
+            std::rethrow_exception(e);
+        }
+    }
+}
+
+}}
+#endif
@@ -0,0 +1,55 @@
+#ifndef QUICKSVG_DETAIL_PIXEL_SET_HPP
+#define QUICKSVG_DETAIL_PIXEL_SET_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace quicksvg { namespace detail {
+
+// One bit per pixel of a width x height graph, used to draw each pixel at most once.
+// At width 1100 the bitmap is under 100kB, so it's cheaper than hashing the points.
+class pixel_set
+{
+public:
+    pixel_set(int width, int height) :
+        m_width{width > 0 ? width : 0},
+        m_height{height > 0 ? height : 0},
+        m_bits((size_t(m_width)*size_t(m_height) + 63)/64)
+    {}
+
+    // Returns true if the pixel containing (x, y) was not yet in the set.
+    // The far edges x == width and y == height belong to the last pixel;
+    // points off the graph are never merged, so they're always reported as new.
+    bool insert(double x, double y)
+    {
+        if (m_bits.empty() || !(x >= 0 && x <= m_width && y >= 0 && y <= m_height))
+        {
+            return true;
+        }
+        size_t column = std::min(size_t(x), size_t(m_width - 1));
+        size_t row = std::min(size_t(y), size_t(m_height - 1));
+        size_t i = row*size_t(m_width) + column;
+        std::uint64_t mask = std::uint64_t(1) << (i % 64);
+        if (m_bits[i/64] & mask)
+        {
+            return false;
+        }
+        m_bits[i/64] |= mask;
+        return true;
+    }
+
+    void clear()
+    {
+        std::fill(m_bits.begin(), m_bits.end(), 0);
+    }
+
+private:
+    int m_width;
+    int m_height;
+    std::vector<std::uint64_t> m_bits;
+};
+
+}}
+#endif
@@ -0,0 +1,281 @@
+#ifndef QUICKSVG_DETAIL_PNG_HPP
+#define QUICKSVG_DETAIL_PNG_HPP
+
+#include <array>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace quicksvg { namespace detail {
+
+// A small PNG encoder, so that raster output doesn't need zlib or libpng.
+// The image data is compressed with a single fixed-Huffman deflate block and a greedy LZ77 matcher;
+// plots are mostly flat color, which that handles well.
+
+inline std::uint32_t crc32(std::uint32_t crc, unsigned char const * data, size_t n)
+{
+    static std::array<std::uint32_t, 256> const table = []
+    {
+        std::array<std::uint32_t, 256> t{};
+        for (std::uint32_t i = 0; i < 256; ++i)
+        {
+            std::uint32_t c = i;
+            for (int k = 0; k < 8; ++k)
+            {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            t[i] = c;
+        }
+        return t;
+    }();
+    crc = ~crc;
+    for (size_t i = 0; i < n; ++i)
+    {
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+inline std::uint32_t adler32(unsigned char const * data, size_t n)
+{
+    std::uint32_t a = 1;
+    std::uint32_t b = 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        a = (a + data[i]) % 65521;
+        b = (b + a) % 65521;
+    }
+    return (b << 16) | a;
+}
+
+// Writes a deflate bit stream: values LSB first, Huffman codes MSB first.
+class bit_writer
+{
+public:
+    explicit bit_writer(std::string & out) : m_out{out}, m_bits{0}, m_count{0} {}
+
+    void bits(std::uint32_t value, int count)
+    {
+        m_bits |= std::uint64_t(value) << m_count;
+        m_count += count;
+        while (m_count >= 8)
+        {
+            m_out.push_back(static_cast<char>(m_bits & 0xFF));
+            m_bits >>= 8;
+            m_count -= 8;
+        }
+    }
+
+    void code(std::uint32_t code, int length)
+    {
+        std::uint32_t reversed = 0;
+        for (int i = 0; i < length; ++i)
+        {
+            reversed |= ((code >> i) & 1) << (length - 1 - i);
+        }
+        bits(reversed, length);
+    }
+
+    void flush()
+    {
+        if (m_count > 0)
+        {
+            m_out.push_back(static_cast<char>(m_bits & 0xFF));
+        }
+        m_bits = 0;
+        m_count = 0;
+    }
+
+private:
+    std::string & m_out;
+    std::uint64_t m_bits;
+    int m_count;
+};
+
+// The zlib stream (RFC 1950/1951) of data, as one fixed-Huffman block.
+inline std::string zlib_compress(std::vector<unsigned char> const & data)
+{
+    static constexpr std::uint16_t length_base[29] = {3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258};
+    static constexpr std::uint8_t length_extra[29] = {0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0};
+    static constexpr std::uint16_t distance_base[30] = {1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577};
+    static constexpr std::uint8_t distance_extra[30] = {0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13};
+
+    std::string out;
+    out.reserve(data.size()/4 + 64);
+    // CMF = deflate with a 32k window, FLG = fastest compression, with the check bits making it a multiple of 31:
+    out.push_back(0x78);
+    out.push_back(0x01);
+    bit_writer w(out);
+    // BFINAL = 1, BTYPE = 01 (fixed Huffman):
+    w.bits(1, 1);
+    w.bits(1, 2);
+
+    auto literal = [&](unsigned v)
+    {
+        if (v < 144)
+        {
+            w.code(0x30 + v, 8);
+        }
+        else if (v < 256)
+        {
+            w.code(0x190 + (v - 144), 9);
+        }
+        else if (v < 280)
+        {
+            w.code(v - 256, 7);
+        }
+        else
+        {
+            w.code(0xC0 + (v - 280), 8);
+        }
+    };
+
+    constexpr size_t window = 32768;
+    constexpr int hash_bits = 15;
+    std::vector<std::int64_t> last(size_t(1) << hash_bits, -1);
+    auto hash = [&](size_t i)
+    {
+        std::uint32_t h = (std::uint32_t(data[i]) << 16) | (std::uint32_t(data[i+1]) << 8) | data[i+2];
+        return (h*2654435761u) >> (32 - hash_bits);
+    };
+
+    size_t n = data.size();
+    size_t i = 0;
+    while (i < n)
+    {
+        size_t length = 0;
+        size_t distance = 0;
+        if (i + 3 <= n)
+        {
+            auto h = hash(i);
+            std::int64_t candidate = last[h];
+            last[h] = static_cast<std::int64_t>(i);
+            if (candidate >= 0 && i - size_t(candidate) <= window)
+            {
+                size_t c = size_t(candidate);
+                size_t limit = std::min<size_t>(258, n - i);
+                while (length < limit && data[c + length] == data[i + length])
+                {
+                    ++length;
+                }
+                distance = i - c;
+            }
+        }
+        if (length < 3)
+        {
+            literal(data[i]);
+            ++i;
+            continue;
+        }
+        int lc = 28;
+        while (length_base[lc] > length)
+        {
+            --lc;
+        }
+        literal(257 + lc);
+        w.bits(static_cast<std::uint32_t>(length - length_base[lc]), length_extra[lc]);
+        int dc = 29;
+        while (distance_base[dc] > distance)
+        {
+            --dc;
+        }
+        w.code(dc, 5);
+        w.bits(static_cast<std::uint32_t>(distance - distance_base[dc]), distance_extra[dc]);
+        i += length;
+    }
+    literal(256);
+    w.flush();
+
+    std::uint32_t adler = adler32(data.data(), data.size());
+    for (int shift = 24; shift >= 0; shift -= 8)
+    {
+        out.push_back(static_cast<char>((adler >> shift) & 0xFF));
+    }
+    return out;
+}
+
+// A PNG of width x height pixels with channels = 3 (RGB) or 4 (RGBA) bytes per pixel, rows top to bottom.
+inline std::string encode_png(unsigned width, unsigned height, unsigned channels, std::vector<unsigned char> const & pixels)
+{
+    if (channels != 3 && channels != 4)
+    {
+        throw std::domain_error("PNG images must have 3 or 4 channels; requested " + std::to_string(channels));
+    }
+    if (pixels.size() != size_t(width)*height*channels)
+    {
+        throw std::domain_error("The pixel buffer does not match the image size.");
+    }
+    // Every row is prefixed with filter type 0 (none):
+    std::vector<unsigned char> raw;
+    raw.reserve(size_t(width*channels + 1)*height);
+    for (unsigned y = 0; y < height; ++y)
+    {
+        raw.push_back(0);
+        auto row = pixels.begin() + size_t(y)*width*channels;
+        raw.insert(raw.end(), row, row + size_t(width)*channels);
+    }
+
+    std::string png("\x89PNG\r\n\x1a\n", 8);
+    auto be32 = [](std::string & s, std::uint32_t v)
+    {
+        for (int shift = 24; shift >= 0; shift -= 8)
+        {
+            s.push_back(static_cast<char>((v >> shift) & 0xFF));
+        }
+    };
+    auto chunk = [&](char const * type, std::string const & data)
+    {
+        be32(png, static_cast<std::uint32_t>(data.size()));
+        std::string body(type, 4);
+        body += data;
+        png += body;
+        be32(png, crc32(0, reinterpret_cast<unsigned char const *>(body.data()), body.size()));
+    };
+
+    std::string header;
+    be32(header, width);
+    be32(header, height);
+    // Bit depth 8, color type 2 (RGB) or 6 (RGBA), deflate, adaptive filtering, no interlace:
+    header.push_back(8);
+    header.push_back(channels == 4 ? 6 : 2);
+    header.push_back(0);
+    header.push_back(0);
+    header.push_back(0);
+    chunk("IHDR", header);
+    chunk("IDAT", zlib_compress(raw));
+    chunk("IEND", "");
+    return png;
+}
+
+inline std::string base64(std::string const & bytes)
+{
+    static char const alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string out;
+    out.reserve(4*((bytes.size() + 2)/3));
+    size_t i = 0;
+    for (; i + 3 <= bytes.size(); i += 3)
+    {
+        std::uint32_t v = (std::uint32_t(std::uint8_t(bytes[i])) << 16) | (std::uint32_t(std::uint8_t(bytes[i+1])) << 8) | std::uint8_t(bytes[i+2]);
+        out.push_back(alphabet[(v >> 18) & 63]);
+        out.push_back(alphabet[(v >> 12) & 63]);
+        out.push_back(alphabet[(v >> 6) & 63]);
+        out.push_back(alphabet[v & 63]);
+    }
+    if (i < bytes.size())
+    {
+        std::uint32_t v = std::uint32_t(std::uint8_t(bytes[i])) << 16;
+        if (i + 1 < bytes.size())
+        {
+            v |= std::uint32_t(std::uint8_t(bytes[i+1])) << 8;
+        }
+        out.push_back(alphabet[(v >> 18) & 63]);
+        out.push_back(alphabet[(v >> 12) & 63]);
+        out.push_back(i + 1 < bytes.size() ? alphabet[(v >> 6) & 63] : '=');
+        out.push_back('=');
+    }
+    return out;
+}
+
+}}
+#endif
@@ -0,0 +1,841 @@
+#ifndef QUICKSVG_DETAIL_RASTER_HPP
+#define QUICKSVG_DETAIL_RASTER_HPP
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "generic_svg_functionality.hpp"
+#include "png.hpp"
+
+namespace quicksvg { namespace detail {
+
+// The raster backend. Rather than teaching every plot a second way to draw itself, what a plot writes
+// to its svg_buffer is rendered to pixels as it is written: the plots only ever emit the handful of elements
+// handled here (<g translate>, <line>, <path>, <circle>, <rect>, <text>), so the layout stays in one place.
+
+struct rgb
+{
+    unsigned char r;
+    unsigned char g;
+    unsigned char b;
+};
+
+// Named colors (the common CSS ones), #rrggbb and rgb(r,g,b). Returns false for 'none' and unknown colors.
+inline bool parse_color(std::string_view s, rgb & c)
+{
+    struct named_color
+    {
+        char const * name;
+        rgb value;
+    };
+    static named_color const colors[] = {
+        {"black", {0, 0, 0}}, {"white", {255, 255, 255}}, {"gray", {128, 128, 128}}, {"grey", {128, 128, 128}},
+        {"red", {255, 0, 0}}, {"green", {0, 128, 0}}, {"blue", {0, 0, 255}}, {"lime", {0, 255, 0}},
+        {"orange", {255, 165, 0}}, {"steelblue", {70, 130, 180}}, {"chartreuse", {127, 255, 0}},
+        {"lightgreen", {144, 238, 144}}, {"yellow", {255, 255, 0}}, {"cyan", {0, 255, 255}},
+        {"magenta", {255, 0, 255}}, {"purple", {128, 0, 128}}, {"pink", {255, 192, 203}}, {"brown", {165, 42, 42}},
+        {"navy", {0, 0, 128}}, {"teal", {0, 128, 128}}, {"olive", {128, 128, 0}}, {"maroon", {128, 0, 0}},
+        {"silver", {192, 192, 192}}, {"gold", {255, 215, 0}}, {"darkgreen", {0, 100, 0}}, {"darkblue", {0, 0, 139}},
+        {"darkred", {139, 0, 0}}, {"lightblue", {173, 216, 230}}, {"lightgray", {211, 211, 211}},
+        {"violet", {238, 130, 238}}, {"indigo", {75, 0, 130}}, {"coral", {255, 127, 80}}, {"salmon", {250, 128, 114}},
+        {"tomato", {255, 99, 71}}, {"turquoise", {64, 224, 208}}, {"crimson", {220, 20, 60}},
+        {"dodgerblue", {30, 144, 255}}, {"skyblue", {135, 206, 235}}, {"firebrick", {178, 34, 34}}};
+    for (auto const & named : colors)
+    {
+        if (s == named.name)
+        {
+            c = named.value;
+            return true;
+        }
+    }
+    if (s.size() == 7 && s[0] == '#')
+    {
+        unsigned v = static_cast<unsigned>(std::strtoul(std::string(s.substr(1)).c_str(), nullptr, 16));
+        c = rgb{static_cast<unsigned char>(v >> 16), static_cast<unsigned char>(v >> 8), static_cast<unsigned char>(v)};
+        return true;
+    }
+    if (s.substr(0, 4) == "rgb(")
+    {
+        int v[3] = {0, 0, 0};
+        char const * p = s.data() + 4;
+        for (int k = 0; k < 3; ++k)
+        {
+            char * end;
+            v[k] = std::clamp(static_cast<int>(std::strtol(p, &end, 10)), 0, 255);
+            p = end + 1;
+        }
+        c = rgb{static_cast<unsigned char>(v[0]), static_cast<unsigned char>(v[1]), static_cast<unsigned char>(v[2])};
+        return true;
+    }
+    return false;
+}
+
+// An RGB image drawn in two steps: shapes are accumulated into a coverage mask (the maximum coverage of
+// each pixel, so the pieces of a polyline don't darken where they overlap), which is then blended into
+// the image in one color. Coverage is antialiased by the distance from the pixel center to the shape.
+class raster_canvas
+{
+public:
+    raster_canvas(int width, int height, rgb background) :
+        m_width{std::max(width, 1)},
+        m_height{std::max(height, 1)},
+        m_pixels(size_t(m_width)*m_height*3),
+        m_mask(size_t(m_width)*m_height, 0.0f)
+    {
+        clear(background);
+    }
+
+    // Paints every pixel the background color and forgets any accumulated shapes.
+    void clear(rgb background)
+    {
+        for (size_t i = 0; i < m_pixels.size(); i += 3)
+        {
+            m_pixels[i] = background.r;
+            m_pixels[i+1] = background.g;
+            m_pixels[i+2] = background.b;
+        }
+        std::fill(m_mask.begin(), m_mask.end(), 0.0f);
+        reset_dirty();
+    }
+
+    int width() const
+    {
+        return m_width;
+    }
+
+    int height() const
+    {
+        return m_height;
+    }
+
+    // Rows top to bottom, 3 bytes per pixel.
+    std::vector<unsigned char> const & pixels() const
+    {
+        return m_pixels;
+    }
+
+    // The segment with round caps of radius r; a zero length segment is a dot.
+    void segment(double x0, double y0, double x1, double y1, double r)
+    {
+        if (!clip(x0, y0, x1, y1, r + 1))
+        {
+            return;
+        }
+        // Short pieces keep the bounding boxes tight for long diagonals:
+        double length = std::hypot(x1 - x0, y1 - y0);
+        int pieces = std::max(1, static_cast<int>(std::ceil(length/4)));
+        for (int k = 0; k < pieces; ++k)
+        {
+            double t0 = double(k)/pieces;
+            double t1 = double(k + 1)/pieces;
+            capsule(x0 + t0*(x1 - x0), y0 + t0*(y1 - y0), x0 + t1*(x1 - x0), y0 + t1*(y1 - y0), r);
+        }
+    }
+
+    void disc(double x, double y, double r)
+    {
+        segment(x, y, x, y, r);
+    }
+
+    // Covers the pixels whose centers are inside the box.
+    void box(double x, double y, double w, double h)
+    {
+        double x0 = std::max(0.0, std::ceil(x - 0.5));
+        double x1 = std::min(double(m_width), std::ceil(x + w - 0.5));
+        double y0 = std::max(0.0, std::ceil(y - 0.5));
+        double y1 = std::min(double(m_height), std::ceil(y + h - 0.5));
+        if (!(x0 < x1 && y0 < y1))
+        {
+            return;
+        }
+        for (int py = int(y0); py < int(y1); ++py)
+        {
+            for (int px = int(x0); px < int(x1); ++px)
+            {
+                cover(px, py, 1.0f);
+            }
+        }
+    }
+
+    // Blends the accumulated shapes into the image in color c, and clears the mask.
+    void composite(rgb c, double opacity = 1)
+    {
+        if (m_x0 > m_x1)
+        {
+            return;
+        }
+        for (int py = m_y0; py <= m_y1; ++py)
+        {
+            for (int px = m_x0; px <= m_x1; ++px)
+            {
+                size_t i = size_t(py)*m_width + px;
+                float a = m_mask[i]*static_cast<float>(opacity);
+                m_mask[i] = 0;
+                if (a <= 0)
+                {
+                    continue;
+                }
+                unsigned char * p = &m_pixels[3*i];
+                p[0] = static_cast<unsigned char>(std::lround(p[0] + a*(c.r - p[0])));
+                p[1] = static_cast<unsigned char>(std::lround(p[1] + a*(c.g - p[1])));
+                p[2] = static_cast<unsigned char>(std::lround(p[2] + a*(c.b - p[2])));
+            }
+        }
+        reset_dirty();
+    }
+
+private:
+    // Liang-Barsky: clips the segment to the canvas grown by margin; false if nothing is left.
+    bool clip(double & x0, double & y0, double & x1, double & y1, double margin) const
+    {
+        if (!(std::isfinite(x0) && std::isfinite(y0) && std::isfinite(x1) && std::isfinite(y1)))
+        {
+            return false;
+        }
+        double t0 = 0;
+        double t1 = 1;
+        double dx = x1 - x0;
+        double dy = y1 - y0;
+        double p[4] = {-dx, dx, -dy, dy};
+        double q[4] = {x0 + margin, m_width + margin - x0, y0 + margin, m_height + margin - y0};
+        for (int k = 0; k < 4; ++k)
+        {
+            if (p[k] == 0)
+            {
+                if (q[k] < 0)
+                {
+                    return false;
+                }
+                continue;
+            }
+            double t = q[k]/p[k];
+            if (p[k] < 0)
+            {
+                t0 = std::max(t0, t);
+            }
+            else
+            {
+                t1 = std::min(t1, t);
+            }
+        }
+        if (t0 > t1)
+        {
+            return false;
+        }
+        double ax = x0 + t0*dx;
+        double ay = y0 + t0*dy;
+        x1 = x0 + t1*dx;
+        y1 = y0 + t1*dy;
+        x0 = ax;
+        y0 = ay;
+        return true;
+    }
+
+    void capsule(double x0, double y0, double x1, double y1, double r)
+    {
+        double dx = x1 - x0;
+        double dy = y1 - y0;
+        double length2 = dx*dx + dy*dy;
+        int px0 = static_cast<int>(std::max(0.0, std::floor(std::min(x0, x1) - r - 1)));
+        int px1 = static_cast<int>(std::min(m_width - 1.0, std::ceil(std::max(x0, x1) + r + 1)));
+        int py0 = static_cast<int>(std::max(0.0, std::floor(std::min(y0, y1) - r - 1)));
+        int py1 = static_cast<int>(std::min(m_height - 1.0, std::ceil(std::max(y0, y1) + r + 1)));
+        for (int py = py0; py <= py1; ++py)
+        {
+            for (int px = px0; px <= px1; ++px)
+            {
+                double cx = px + 0.5;
+                double cy = py + 0.5;
+                double t = length2 > 0 ? std::clamp(((cx - x0)*dx + (cy - y0)*dy)/length2, 0.0, 1.0) : 0.0;
+                double d = std::hypot(x0 + t*dx - cx, y0 + t*dy - cy);
+                double coverage = std::min(1.0, r + 0.5 - d);
+                if (coverage > 0)
+                {
+                    cover(px, py, static_cast<float>(coverage));
+                }
+            }
+        }
+    }
+
+    void cover(int px, int py, float coverage)
+    {
+        float & m = m_mask[size_t(py)*m_width + px];
+        m = std::max(m, coverage);
+        m_x0 = std::min(m_x0, px);
+        m_x1 = std::max(m_x1, px);
+        m_y0 = std::min(m_y0, py);
+        m_y1 = std::max(m_y1, py);
+    }
+
+    void reset_dirty()
+    {
+        m_x0 = m_width;
+        m_x1 = -1;
+        m_y0 = m_height;
+        m_y1 = -1;
+    }
+
+    int m_width;
+    int m_height;
+    std::vector<unsigned char> m_pixels;
+    std::vector<float> m_mask;
+    int m_x0;
+    int m_x1;
+    int m_y0;
+    int m_y1;
+};
+
+// Binary PPM (P6): a header and the raw pixels.
+inline std::string encode_ppm(raster_canvas const & canvas)
+{
+    std::string ppm = "P6\n" + std::to_string(canvas.width()) + " " + std::to_string(canvas.height()) + "\n255\n";
+    ppm.append(reinterpret_cast<char const *>(canvas.pixels().data()), canvas.pixels().size());
+    return ppm;
+}
+
+// 5x7 glyphs for printable ASCII, one byte per row (bit 4 = leftmost column); nullptr for anything else.
+inline unsigned char const * glyph(char c)
+{
+    static unsigned char const font[95][7] = {
+        {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, {0x04, 0x04, 0x04, 0x04, 0x04, 0x00, 0x04}, {0x0A, 0x0A, 0x0A, 0x00, 0x00, 0x00, 0x00},
+        {0x0A, 0x0A, 0x1F, 0x0A, 0x1F, 0x0A, 0x0A}, {0x04, 0x0F, 0x14, 0x0E, 0x05, 0x1E, 0x04}, {0x18, 0x19, 0x02, 0x04, 0x08, 0x13, 0x03},
+        {0x0C, 0x12, 0x14, 0x08, 0x15, 0x12, 0x0D}, {0x0C, 0x04, 0x08, 0x00, 0x00, 0x00, 0x00}, {0x02, 0x04, 0x08, 0x08, 0x08, 0x04, 0x02},
+        {0x08, 0x04, 0x02, 0x02, 0x02, 0x04, 0x08}, {0x00, 0x04, 0x15, 0x0E, 0x15, 0x04, 0x00}, {0x00, 0x04, 0x04, 0x1F, 0x04, 0x04, 0x00},
+        {0x00, 0x00, 0x00, 0x00, 0x0C, 0x04, 0x08}, {0x00, 0x00, 0x00, 0x1F, 0x00, 0x00, 0x00}, {0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C},
+        {0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00}, {0x0E, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0E}, {0x04, 0x0C, 0x04, 0x04, 0x04, 0x04, 0x0E},
+        {0x0E, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1F}, {0x1F, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0E}, {0x02, 0x06, 0x0A, 0x12, 0x1F, 0x02, 0x02},
+        {0x1F, 0x10, 0x1E, 0x01, 0x01, 0x11, 0x0E}, {0x06, 0x08, 0x10, 0x1E, 0x11, 0x11, 0x0E}, {0x1F, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08},
+        {0x0E, 0x11, 0x11, 0x0E, 0x11, 0x11, 0x0E}, {0x0E, 0x11, 0x11, 0x0F, 0x01, 0x02, 0x0C}, {0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x0C, 0x00},
+        {0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x04, 0x08}, {0x02, 0x04, 0x08, 0x10, 0x08, 0x04, 0x02}, {0x00, 0x00, 0x1F, 0x00, 0x1F, 0x00, 0x00},
+        {0x08, 0x04, 0x02, 0x01, 0x02, 0x04, 0x08}, {0x0E, 0x11, 0x01, 0x02, 0x04, 0x00, 0x04}, {0x0E, 0x11, 0x01, 0x0D, 0x15, 0x15, 0x0E},
+        {0x0E, 0x11, 0x11, 0x11, 0x1F, 0x11, 0x11}, {0x1E, 0x11, 0x11, 0x1E, 0x11, 0x11, 0x1E}, {0x0E, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0E},
+        {0x1C, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1C}, {0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x1F}, {0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x10},
+        {0x0E, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0F}, {0x11, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11}, {0x0E, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E},
+        {0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0C}, {0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11}, {0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1F},
+        {0x11, 0x1B, 0x15, 0x15, 0x11, 0x11, 0x11}, {0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11}, {0x0E, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E},
+        {0x1E, 0x11, 0x11, 0x1E, 0x10, 0x10, 0x10}, {0x0E, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0D}, {0x1E, 0x11, 0x11, 0x1E, 0x14, 0x12, 0x11},
+        {0x0F, 0x10, 0x10, 0x0E, 0x01, 0x01, 0x1E}, {0x1F, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04}, {0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E},
+        {0x11, 0x11, 0x11, 0x11, 0x11, 0x0A, 0x04}, {0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0A}, {0x11, 0x11, 0x0A, 0x04, 0x0A, 0x11, 0x11},
+        {0x11, 0x11, 0x11, 0x0A, 0x04, 0x04, 0x04}, {0x1F, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1F}, {0x0E, 0x08, 0x08, 0x08, 0x08, 0x08, 0x0E},
+        {0x00, 0x10, 0x08, 0x04, 0x02, 0x01, 0x00}, {0x0E, 0x02, 0x02, 0x02, 0x02, 0x02, 0x0E}, {0x04, 0x0A, 0x11, 0x00, 0x00, 0x00, 0x00},
+        {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1F}, {0x08, 0x04, 0x02, 0x00, 0x00, 0x00, 0x00}, {0x00, 0x00, 0x0E, 0x01, 0x0F, 0x11, 0x0F},
+        {0x10, 0x10, 0x16, 0x19, 0x11, 0x11, 0x1E}, {0x00, 0x00, 0x0E, 0x10, 0x10, 0x11, 0x0E}, {0x01, 0x01, 0x0D, 0x13, 0x11, 0x11, 0x0F},
+        {0x00, 0x00, 0x0E, 0x11, 0x1F, 0x10, 0x0E}, {0x06, 0x09, 0x08, 0x1C, 0x08, 0x08, 0x08}, {0x00, 0x0F, 0x11, 0x11, 0x0F, 0x01, 0x0E},
+        {0x10, 0x10, 0x16, 0x19, 0x11, 0x11, 0x11}, {0x04, 0x00, 0x0C, 0x04, 0x04, 0x04, 0x0E}, {0x02, 0x00, 0x06, 0x02, 0x02, 0x12, 0x0C},
+        {0x10, 0x10, 0x12, 0x14, 0x18, 0x14, 0x12}, {0x0C, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E}, {0x00, 0x00, 0x1A, 0x15, 0x15, 0x11, 0x11},
+        {0x00, 0x00, 0x16, 0x19, 0x11, 0x11, 0x11}, {0x00, 0x00, 0x0E, 0x11, 0x11, 0x11, 0x0E}, {0x00, 0x00, 0x1E, 0x11, 0x1E, 0x10, 0x10},
+        {0x00, 0x00, 0x0D, 0x13, 0x0F, 0x01, 0x01}, {0x00, 0x00, 0x16, 0x19, 0x10, 0x10, 0x10}, {0x00, 0x00, 0x0E, 0x10, 0x0E, 0x01, 0x1E},
+        {0x08, 0x08, 0x1C, 0x08, 0x08, 0x09, 0x06}, {0x00, 0x00, 0x11, 0x11, 0x11, 0x13, 0x0D}, {0x00, 0x00, 0x11, 0x11, 0x11, 0x0A, 0x04},
+        {0x00, 0x00, 0x11, 0x11, 0x15, 0x15, 0x0A}, {0x00, 0x00, 0x11, 0x0A, 0x04, 0x0A, 0x11}, {0x00, 0x00, 0x11, 0x11, 0x0F, 0x01, 0x0E},
+        {0x00, 0x00, 0x1F, 0x02, 0x04, 0x08, 0x1F}, {0x02, 0x04, 0x04, 0x08, 0x04, 0x04, 0x02}, {0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04},
+        {0x08, 0x04, 0x04, 0x02, 0x04, 0x04, 0x08}, {0x00, 0x00, 0x08, 0x15, 0x02, 0x00, 0x00}
+    };
+    if (c < ' ' || c > '~')
+    {
+        return nullptr;
+    }
+    return font[c - ' '];
+}
+
+// Renders a plot into a raster_canvas as its svg_buffer hands it over: elements are drawn as soon as
+// they're complete and paths arrive as batches of points, so neither the SVG text nor the path data is kept.
+// Embedded <image>s are skipped; scatter_plot draws its density heatmap as <rect>s for bitmaps.
+class svg_rasterizer : public svg_sink
+{
+public:
+    size_t consume(std::string_view svg) override
+    {
+        size_t consumed = 0;
+        size_t i = 0;
+        while ((i = svg.find('<', i)) != std::string_view::npos)
+        {
+            size_t end = svg.find('>', i);
+            if (end == std::string_view::npos)
+            {
+                break;
+            }
+            std::string_view tag = svg.substr(i + 1, end - i - 1);
+            size_t next = end + 1;
+            if (tag.empty() || tag[0] == '?' || tag[0] == '!')
+            {
+                i = consumed = next;
+                continue;
+            }
+            if (tag[0] == '/')
+            {
+                if (tag == "/g" && !m_offsets.empty())
+                {
+                    m_offsets.pop_back();
+                }
+                i = consumed = next;
+                continue;
+            }
+            size_t name_end = tag.find_first_of(" \n/");
+            std::string_view name = tag.substr(0, name_end);
+            auto attributes = parse_attributes(tag.substr(std::min(name_end, tag.size())));
+            if (name == "style" || name == "text")
+            {
+                // Wait for the closing tag:
+                std::string_view close = (name == "style") ? "</style>" : "</text>";
+                size_t close_begin = svg.find(close, next);
+                if (close_begin == std::string_view::npos)
+                {
+                    break;
+                }
+                if (name == "text" && m_canvas)
+                {
+                    text(attributes, svg.substr(next, close_begin - next));
+                }
+                next = close_begin + close.size();
+            }
+            else if (name == "svg")
+            {
+                int width = static_cast<int>(number(attributes, "width", 1));
+                int height = static_cast<int>(number(attributes, "height", 1));
+                // A plot redrawn at the same size reuses the image:
+                if (m_canvas && m_canvas->width() == width && m_canvas->height() == height)
+                {
+                    m_canvas->clear(rgb{0, 0, 0});
+                }
+                else
+                {
+                    m_canvas.emplace(width, height, rgb{0, 0, 0});
+                }
+            }
+            else if (m_canvas)
+            {
+                element(name, attributes);
+            }
+            i = consumed = next;
+        }
+        return consumed;
+    }
+
+    void begin_path(std::string_view stroke, double stroke_width, std::string_view extra_attributes) override
+    {
+        m_path_radius = stroke_width/2;
+        m_path_opacity = parse_color(stroke, m_path_color) ? number(parse_attributes(extra_attributes), "opacity", 1) : 0;
+    }
+
+    void path_points(std::vector<double> const & xy) override
+    {
+        auto [ox, oy] = offset();
+        for (size_t k = 2; k + 1 < xy.size(); k += 2)
+        {
+            // Segments ending at or starting from a subpath break are NaN, and clipped away:
+            canvas().segment(ox + xy[k-2], oy + xy[k-1], ox + xy[k], oy + xy[k+1], m_path_radius);
+        }
+    }
+
+    void end_path() override
+    {
+        canvas().composite(m_path_color, m_path_opacity);
+    }
+
+    void clear() override
+    {
+        m_offsets.clear();
+    }
+
+    // Writes a PNG, or a binary PPM if filename ends in .ppm.
+    void write(std::string const & filename) override
+    {
+        auto const & c = canvas();
+        bool ppm = filename.size() >= 4 && filename.compare(filename.size() - 4, 4, ".ppm") == 0;
+        svg_buffer::write_file(filename, ppm ? encode_ppm(c) : encode_png(c.width(), c.height(), 3, c.pixels()));
+    }
+
+    raster_canvas & canvas()
+    {
+        if (!m_canvas)
+        {
+            throw std::domain_error("Cannot rasterize an SVG without an <svg> element.");
+        }
+        return *m_canvas;
+    }
+
+private:
+    using attribute_list = std::vector<std::pair<std::string_view, std::string_view>>;
+
+    static attribute_list parse_attributes(std::string_view s)
+    {
+        attribute_list attributes;
+        size_t i = 0;
+        while (true)
+        {
+            size_t eq = s.find('=', i);
+            if (eq == std::string_view::npos || eq + 1 >= s.size())
+            {
+                break;
+            }
+            char quote = s[eq + 1];
+            size_t close = s.find(quote, eq + 2);
+            if (close == std::string_view::npos)
+            {
+                break;
+            }
+            size_t name_begin = s.find_last_of(" \n", eq);
+            name_begin = (name_begin == std::string_view::npos) ? 0 : name_begin + 1;
+            attributes.emplace_back(s.substr(name_begin, eq - name_begin), s.substr(eq + 2, close - eq - 2));
+            i = close + 1;
+        }
+        return attributes;
+    }
+
+    static std::string_view attribute(attribute_list const & attributes, std::string_view name)
+    {
+        for (auto const & a : attributes)
+        {
+            if (a.first == name)
+            {
+                return a.second;
+            }
+        }
+        return {};
+    }
+
+    // Parses a number at p, skipping separators; returns false at a letter or the end.
+    static bool parse_number(char const * & p, char const * end, double & v)
+    {
+        while (p < end && (*p == ' ' || *p == ',' || *p == '\n'))
+        {
+            ++p;
+        }
+        if (p == end || !(*p == '-' || *p == '+' || *p == '.' || (*p >= '0' && *p <= '9')))
+        {
+            return false;
+        }
+        if (*p == '+')
+        {
+            ++p;
+        }
+#ifdef __cpp_lib_to_chars
+        auto result = std::from_chars(p, end, v);
+        if (result.ec != std::errc())
+        {
+            return false;
+        }
+        p = result.ptr;
+#else
+        std::string s(p, std::min<size_t>(end - p, 64));
+        char * stop;
+        v = std::strtod(s.c_str(), &stop);
+        if (stop == s.c_str())
+        {
+            return false;
+        }
+        p += stop - s.c_str();
+#endif
+        return true;
+    }
+
+    static double number(attribute_list const & attributes, std::string_view name, double fallback)
+    {
+        std::string_view s = attribute(attributes, name);
+        char const * p = s.data();
+        double v;
+        return parse_number(p, s.data() + s.size(), v) ? v : fallback;
+    }
+
+    // The arguments of the first name(...) in a transform, e.g. {2, 3} for "translate(2, 3)".
+    static std::vector<double> transform_arguments(std::string_view transform, std::string_view name)
+    {
+        std::vector<double> args;
+        size_t i = transform.find(name);
+        if (i == std::string_view::npos)
+        {
+            return args;
+        }
+        char const * p = transform.data() + i + name.size() + 1;
+        char const * end = transform.data() + transform.size();
+        double v;
+        while (parse_number(p, end, v))
+        {
+            args.push_back(v);
+        }
+        return args;
+    }
+
+    static std::pair<double, double> translation(std::string_view transform)
+    {
+        auto args = transform_arguments(transform, "translate");
+        return {args.size() > 0 ? args[0] : 0, args.size() > 1 ? args[1] : 0};
+    }
+
+    void element(std::string_view name, attribute_list const & attributes)
+    {
+        if (name == "g")
+        {
+            auto [x, y] = translation(attribute(attributes, "transform"));
+            auto [ox, oy] = offset();
+            m_offsets.emplace_back(ox + x, oy + y);
+        }
+        else if (name == "line")
+        {
+            line(attributes);
+        }
+        else if (name == "path")
+        {
+            path(attributes);
+        }
+        else if (name == "circle")
+        {
+            circle(attributes);
+        }
+        else if (name == "rect")
+        {
+            rect(attributes);
+        }
+    }
+
+    std::pair<double, double> offset() const
+    {
+        return m_offsets.empty() ? std::pair<double, double>(0, 0) : m_offsets.back();
+    }
+
+    void paint(attribute_list const & attributes, std::string_view paint_attribute)
+    {
+        rgb c;
+        if (!parse_color(attribute(attributes, paint_attribute), c))
+        {
+            c = rgb{0, 0, 0};
+            m_canvas->composite(c, 0);
+            return;
+        }
+        m_canvas->composite(c, number(attributes, "opacity", 1));
+    }
+
+    void line(attribute_list const & attributes)
+    {
+        auto [ox, oy] = offset();
+        double x0 = ox + number(attributes, "x1", 0);
+        double y0 = oy + number(attributes, "y1", 0);
+        double x1 = ox + number(attributes, "x2", 0);
+        double y1 = oy + number(attributes, "y2", 0);
+        double r = number(attributes, "stroke-width", 1)/2;
+        double dash = number(attributes, "stroke-dasharray", 0);
+        double length = std::hypot(x1 - x0, y1 - y0);
+        if (dash <= 0 || length == 0 || !std::isfinite(length))
+        {
+            m_canvas->segment(x0, y0, x1, y1, r);
+        }
+        else
+        {
+            for (double s = 0; s < length; s += 2*dash)
+            {
+                double t0 = s/length;
+                double t1 = std::min(s + dash, length)/length;
+                m_canvas->segment(x0 + t0*(x1 - x0), y0 + t0*(y1 - y0), x0 + t1*(x1 - x0), y0 + t1*(y1 - y0), r);
+            }
+        }
+        paint(attributes, "stroke");
+    }
+
+    void path(attribute_list const & attributes)
+    {
+        auto [ox, oy] = offset();
+        auto scale_args = transform_arguments(attribute(attributes, "transform"), "scale");
+        double scale = scale_args.empty() ? 1 : scale_args[0];
+        double r = number(attributes, "stroke-width", 1)*scale/2;
+        std::string_view d = attribute(attributes, "d");
+        char const * p = d.data();
+        char const * end = d.data() + d.size();
+        char command = 'M';
+        double x = 0;
+        double y = 0;
+        double start_x = 0;
+        double start_y = 0;
+        auto draw_to = [&](double nx, double ny)
+        {
+            m_canvas->segment(ox + x*scale, oy + y*scale, ox + nx*scale, oy + ny*scale, r);
+            x = nx;
+            y = ny;
+        };
+        while (p < end)
+        {
+            while (p < end && (*p == ' ' || *p == ',' || *p == '\n'))
+            {
+                ++p;
+            }
+            if (p == end)
+            {
+                break;
+            }
+            if ((*p >= 'A' && *p <= 'Z') || (*p >= 'a' && *p <= 'z'))
+            {
+                command = *p++;
+                if (command == 'Z' || command == 'z')
+                {
+                    draw_to(start_x, start_y);
+                }
+                continue;
+            }
+            double a;
+            double b = 0;
+            if (!parse_number(p, end, a))
+            {
+                break;
+            }
+            bool pair = !(command == 'H' || command == 'h' || command == 'V' || command == 'v');
+            if (pair && !parse_number(p, end, b))
+            {
+                break;
+            }
+            switch (command)
+            {
+                case 'M': x = start_x = a; y = start_y = b; command = 'L'; break;
+                case 'm': x = start_x = x + a; y = start_y = y + b; command = 'l'; break;
+                case 'L': draw_to(a, b); break;
+                case 'l': draw_to(x + a, y + b); break;
+                case 'H': draw_to(a, y); break;
+                case 'h': draw_to(x + a, y); break;
+                case 'V': draw_to(x, a); break;
+                case 'v': draw_to(x, y + a); break;
+                default: break;
+            }
+        }
+        paint(attributes, "stroke");
+    }
+
+    void circle(attribute_list const & attributes)
+    {
+        auto [ox, oy] = offset();
+        m_canvas->disc(ox + number(attributes, "cx", 0), oy + number(attributes, "cy", 0), number(attributes, "r", 0));
+        paint(attributes, "fill");
+    }
+
+    void rect(attribute_list const & attributes)
+    {
+        auto [ox, oy] = offset();
+        m_canvas->box(ox + number(attributes, "x", 0), oy + number(attributes, "y", 0),
+                      number(attributes, "width", 0), number(attributes, "height", 0));
+        paint(attributes, "fill");
+    }
+
+    // The characters of a <text> element with the XML entities decoded; characters without a glyph
+    // (including each multi-byte UTF-8 sequence) become a '?'.
+    static std::string text_content(std::string_view raw)
+    {
+        static std::pair<std::string_view, char> const entities[] = {
+            {"&amp;", '&'}, {"&lt;", '<'}, {"&gt;", '>'}, {"&quot;", '"'}, {"&apos;", '\''}};
+        std::string content;
+        for (size_t i = 0; i < raw.size(); ++i)
+        {
+            char c = raw[i];
+            if (c == '&')
+            {
+                for (auto const & e : entities)
+                {
+                    if (raw.substr(i, e.first.size()) == e.first)
+                    {
+                        c = e.second;
+                        i += e.first.size() - 1;
+                        break;
+                    }
+                }
+            }
+            else if ((static_cast<unsigned char>(c) & 0xC0) == 0x80)
+            {
+                continue;
+            }
+            content.push_back(glyph(c) ? c : '?');
+        }
+        return content;
+    }
+
+    void text(attribute_list const & attributes, std::string_view raw)
+    {
+        std::string content = text_content(raw);
+        auto [ox, oy] = offset();
+        int scale = std::max(1, static_cast<int>(std::lround(number(attributes, "font-size", 10)/10)));
+        double width = (6.0*content.size() - 1)*scale;
+        double x = number(attributes, "x", 0);
+        double y = number(attributes, "y", 0);
+        std::string_view anchor = attribute(attributes, "text-anchor");
+        if (anchor == "middle")
+        {
+            x -= width/2;
+        }
+        else if (anchor == "end")
+        {
+            x -= width;
+        }
+        // y is the baseline, unless the text is centered on it:
+        double top = (attribute(attributes, "alignment-baseline") == "middle") ? y - 3.5*scale : y - 7*scale;
+
+        // translate(a, b) and rotate(angle [cx cy]), in that order, as in the labels of the gridlines:
+        std::string_view transform = attribute(attributes, "transform");
+        auto [tx, ty] = translation(transform);
+        auto rotation = transform_arguments(transform, "rotate");
+        double angle = rotation.empty() ? 0 : rotation[0]*3.14159265358979/180;
+        double cx = rotation.size() > 2 ? rotation[1] : 0;
+        double cy = rotation.size() > 2 ? rotation[2] : 0;
+        double cos_a = std::cos(angle);
+        double sin_a = std::sin(angle);
+        auto map = [&](double px, double py)->std::pair<double, double>
+        {
+            double rx = cx + (px - cx)*cos_a - (py - cy)*sin_a;
+            double ry = cy + (px - cx)*sin_a + (py - cy)*cos_a;
+            return {ox + tx + rx, oy + ty + ry};
+        };
+
+        for (size_t k = 0; k < content.size(); ++k)
+        {
+            unsigned char const * rows = glyph(content[k]);
+            for (int row = 0; row < 7; ++row)
+            {
+                for (int col = 0; col < 5; ++col)
+                {
+                    if (!(rows[row] & (0x10 >> col)))
+                    {
+                        continue;
+                    }
+                    double px = x + (6*k + col)*scale;
+                    double py = top + row*scale;
+                    auto [ax, ay] = map(px, py);
+                    auto [bx, by] = map(px + scale, py + scale);
+                    m_canvas->box(std::min(ax, bx), std::min(ay, by), std::abs(bx - ax), std::abs(by - ay));
+                }
+            }
+        }
+        paint(attributes, "fill");
+    }
+
+    std::optional<raster_canvas> m_canvas;
+    std::vector<std::pair<double, double>> m_offsets;
+    // Stroke of the path being drawn:
+    double m_path_radius = 0;
+    rgb m_path_color = {0, 0, 0};
+    double m_path_opacity = 0;
+};
+
+inline bool is_raster(std::string const & filename)
+{
+    auto ends_with = [&](std::string_view suffix)
+    {
+        return filename.size() >= suffix.size() && filename.compare(filename.size() - suffix.size(), suffix.size(), suffix) == 0;
+    };
+    return ends_with(".png") || ends_with(".ppm");
+}
+
+// The sink for svg_buffer::set_sink when writing filename: a rasterizer for .png and .ppm, and none for SVG text.
+inline std::unique_ptr<svg_sink> raster_sink(std::string const & filename)
+{
+    if (!is_raster(filename))
+    {
+        return nullptr;
+    }
+    return std::make_unique<svg_rasterizer>();
+}
+
+}}
+#endif
@@ -1,6 +1,8 @@
 #ifndef QUICKSVG_GRAPH_FN_HPP
 #define QUICKSVG_GRAPH_FN_HPP
 #include "detail/generic_svg_functionality.hpp"
+#include "detail/parallel_for.hpp"
+#include "detail/raster.hpp"
 #include <iomanip>
 #include <cassert>
 #include <sstream>
@@ -8,6 +10,8 @@
 #include <utility>
 #include <fstream>
 #include <iostream>
+#include <algorithm>
+#include <queue>
 
 namespace quicksvg {
 
@@ -22,9 +26,13 @@ public:
              m_is_written{false},
              m_stroke_width{1},
              m_horizontal_lines{8},
-             m_vertical_lines{10}
+             m_vertical_lines{10},
+             m_compact_paths{false},
+             m_pixel_tolerance{0},
+             m_max_evaluations{0},
+             m_threads{1}
     {
-        m_fs.open(filename);
+        m_filename = filename;
         assert(m_max_x > m_min_x);
         if (samples < 10)
         {
@@ -52,7 +60,8 @@ public:
         m_min_y = std::numeric_limits<Real>::max();
         m_max_y = std::numeric_limits<Real>::lowest();
 
-        detail::write_prelude(m_fs, title, width, height, m_margin_top);
+        m_svg.set_sink(detail::raster_sink(filename));
+        detail::write_prelude(m_svg, title, width, height, m_margin_top);
     }
 
     void set_stroke_width(int sw)
@@ -66,6 +75,39 @@ public:
         m_vertical_lines = vertical_lines;
     }
 
+    // Number of decimals printed for coordinates; 3 by default.
+    void set_precision(int decimals)
+    {
+        m_svg.set_precision(decimals);
+    }
+
+    // Writes paths in the compact encoding of detail::path_writer.
+    void set_compact_paths(bool compact)
+    {
+        m_compact_paths = compact;
+    }
+
+    // Start from the evenly spaced samples and bisect wherever the graph's line segments are off by more than
+    // pixel_tolerance pixels, worst first, until the error is below tolerance or max_evaluations calls have been made.
+    // pixel_tolerance = 0 turns it off again.
+    void set_adaptive(Real pixel_tolerance, unsigned max_evaluations = 10000)
+    {
+        if (pixel_tolerance < 0)
+        {
+            throw std::domain_error("The pixel tolerance must be nonnegative.");
+        }
+        m_pixel_tolerance = pixel_tolerance;
+        m_max_evaluations = max_evaluations;
+    }
+
+    // Evaluate the evenly spaced samples of add_fn on this many threads (0 = all cores); f must then be safe to call concurrently.
+    // The graph, and the x reported when f returns a NaN, are the same as for the serial evaluation.
+    // Adaptive sampling is inherently sequential and ignores this.
+    void set_threads(unsigned threads)
+    {
+        m_threads = threads;
+    }
+
     template<class F>
     void add_fn(F f, std::string const & color="steelblue")
     {
@@ -73,35 +115,76 @@ public:
         {
             throw std::logic_error("Cannot add data to graph after writing it.\n");
         }
+        if (m_pixel_tolerance > 0)
+        {
+            add_fn_adaptive(f, color);
+            return;
+        }
 
         std::vector<Real> v(m_samples);
-        for(size_t i = 0; i < v.size(); ++i)
+        Real step = (m_max_x - m_min_x)/(m_samples - static_cast<Real>(1));
+        // Each chunk stops at its first NaN, and parallel_for rethrows the error of the lowest chunk,
+        // so the NaN reported is the one at the smallest x.
+        size_t chunks = detail::chunk_count(v.size(), m_threads);
+        std::vector<Real> min_y(chunks, std::numeric_limits<Real>::max());
+        std::vector<Real> max_y(chunks, std::numeric_limits<Real>::lowest());
+        detail::parallel_for(v.size(), m_threads, [&](size_t chunk, size_t begin, size_t end)
         {
-            Real step = (m_max_x - m_min_x)/(m_samples - static_cast<Real>(1));
-            Real x = m_min_x + step*i;
-            v[i] = f(x);
-
-            using std::isnan;
-            if (isnan(v[i]))
+            for (size_t i = begin; i < end; ++i)
             {
-                // This throw leaves a partially written file on disk.
-                // The class should instead write the whole thing to an ostringstream, and then write the result to disk.
-                std::ostringstream oss;
-                oss << "Evaluating your function at x = " << x << " returned a NaN; which cannot be graphed.\n";
-                throw std::domain_error(oss.str());
+                Real x = m_min_x + step*i;
+                v[i] = f(x);
+                check_nan(x, v[i]);
             }
-
-            if (v[i] > m_max_y)
+            detail::minmax(v.data() + begin, end - begin, 1, min_y[chunk], max_y[chunk]);
+        });
+        for (size_t chunk = 0; chunk < chunks; ++chunk)
+        {
+            if (min_y[chunk] < m_min_y)
             {
-                m_max_y = v[i];
+                m_min_y = min_y[chunk];
             }
-            if (v[i] < m_min_y)
+            if (max_y[chunk] > m_max_y)
             {
-                m_min_y = v[i];
+                m_max_y = max_y[chunk];
             }
         }
 
-        m_dataset.emplace_back(v);
+        m_dataset.emplace_back(std::move(v));
+        m_abscissas.emplace_back();
+        m_connect_color.emplace_back(color);
+    }
+
+    // Calls f(x, y) once, with x holding all the evenly spaced abscissas and y sized to match,
+    // so that a vectorized or multithreaded kernel can fill in every ordinate at once.
+    template<class F>
+    void add_fn_batch(F f, std::string const & color="steelblue")
+    {
+        if (m_is_written)
+        {
+            throw std::logic_error("Cannot add data to graph after writing it.\n");
+        }
+        std::vector<Real> x(m_samples);
+        Real step = (m_max_x - m_min_x)/(m_samples - static_cast<Real>(1));
+        for (size_t i = 0; i < x.size(); ++i)
+        {
+            x[i] = m_min_x + step*i;
+        }
+        std::vector<Real> v(m_samples);
+        f(static_cast<std::vector<Real> const &>(x), v);
+        if (v.size() != x.size())
+        {
+            throw std::logic_error("The batch function resized its output from " + std::to_string(x.size()) + " to " + std::to_string(v.size()) + " ordinates.");
+        }
+        // Checked in order, so a NaN is reported at the smallest x that produced one:
+        for (size_t i = 0; i < v.size(); ++i)
+        {
+            check_nan(x[i], v[i]);
+        }
+        detail::minmax(v.data(), v.size(), 1, m_min_y, m_max_y);
+
+        m_dataset.emplace_back(std::move(v));
+        m_abscissas.emplace_back();
         m_connect_color.emplace_back(color);
     }
 
@@ -119,60 +202,68 @@ public:
           throw std::logic_error("The data max is less than the data minimum. Did you add data to the graph?\n");
       }
 
-      auto x_scale = [this](Real x)->Real
-      {
-          return ((x-m_min_x)/(m_max_x - m_min_x))*static_cast<Real>(m_graph_width);
-      };
-
-      auto y_scale = [this](Real y)->Real
-      {
-          return ((m_max_y - y)/(m_max_y - m_min_y))*static_cast<Real>(m_graph_height);
-      };
+      detail::axis_map<Real> x_scale(m_min_x, m_max_x, m_graph_width);
+      detail::axis_map<Real> y_scale(m_min_y, m_max_y, m_graph_height, true);
 
         // Construct SVG group to simplify the calculations slightly:
-      m_fs << "<g transform='translate(" << m_margin_left << ", " << m_margin_top << ")'>\n";
+      m_svg << "<g transform='translate(" << m_margin_left << ", " << m_margin_top << ")'>\n";
            // y-axis:
-      m_fs  << "<line x1='0' y1='0' x2='0' y2='" << m_graph_height
+      m_svg << "<line x1='0' y1='0' x2='0' y2='" << m_graph_height
             << "' stroke='gray' stroke-width='1' />\n";
       // x-axis: If 0 is between the min a max height, place the axis at zero.
       // Otherwise, place is at the bottom of the graph.
-      Real x_axis_loc = m_graph_height;
+      double x_axis_loc = m_graph_height;
       if (m_min_y <= 0 && m_max_y >= 0)
       {
           x_axis_loc = y_scale(0);
       }
-      m_fs << "<line x1='0' y1='" << x_axis_loc
-           << "' x2='" << m_graph_width << "' y2='" << x_axis_loc
-           << "' stroke='gray' stroke-width='1' />\n";
+      m_svg << "<line x1='0' y1='" << x_axis_loc
+            << "' x2='" << m_graph_width << "' y2='" << x_axis_loc
+            << "' stroke='gray' stroke-width='1' />\n";
 
-      detail::write_gridlines(m_fs, m_horizontal_lines, m_vertical_lines, x_scale, y_scale, m_min_x, m_max_x,
+      detail::write_gridlines(m_svg, m_horizontal_lines, m_vertical_lines, x_scale, y_scale, m_min_x, m_max_x,
                               m_min_y, m_max_y, m_graph_width, m_graph_height, m_margin_left);
 
 
-      Real step = (m_max_x - m_min_x)/(m_samples - 1.0);
+      // Evenly spaced samples are step pixels apart:
+      double step = m_graph_width/(m_samples - 1.0);
+      // Screen coordinates of the current dataset:
+      std::vector<double> xs;
+      std::vector<double> ys;
       for (size_t i = 0; i < m_dataset.size(); ++i)
       {
           auto const & v = m_dataset[i];
+          // Adaptively sampled functions carry their abscissas; the others are evenly spaced.
+          auto const & x = m_abscissas[i];
           std::string const & stroke = m_connect_color[i];
 
-          m_fs << "<path d='M" << x_scale(m_min_x) << " " << y_scale(v[0]);
+          ys.resize(v.size());
+          y_scale.transform(v.data(), v.size(), 1, ys.data());
+          if (!x.empty())
+          {
+              xs.resize(x.size());
+              x_scale.transform(x.data(), x.size(), 1, xs.data());
+          }
+
+          detail::path_writer path(m_svg, m_compact_paths, stroke, m_stroke_width);
+          path.move_to(0, ys[0]);
           for (size_t j = 1; j < v.size(); ++j)
           {
-              Real t = x_scale(m_min_x + j*step);
-              Real y = y_scale(v[j]);
+              double t = x.empty() ? j*step : xs[j];
+              double y = ys[j];
               using std::isnan;
               if (isnan(y))
               {
                   throw std::domain_error("The domain rescaled data is a nan!");
               }
-              m_fs << " L" << t << " " << y;
+              path.line_to(t, y);
           }
-          m_fs << "' stroke='" << stroke << "' stroke-width='" << m_stroke_width << "' fill='none'></path>\n";
+          path.close();
       }
 
-      m_fs << "</g>\n"
-         << "</svg>\n";
-      m_fs.close();
+      m_svg << "</g>\n"
+          << "</svg>\n";
+      m_svg.write_to(m_filename);
 
       m_is_written = true;
     }
@@ -186,14 +277,123 @@ public:
     }
 
 private:
+    static void check_nan(Real x, Real y)
+    {
+        using std::isnan;
+        if (isnan(y))
+        {
+            std::ostringstream oss;
+            oss << "Evaluating your function at x = " << x << " returned a NaN; which cannot be graphed.\n";
+            throw std::domain_error(oss.str());
+        }
+    }
+
+    // Rejects NaNs and widens the y-range to include y.
+    void track(Real x, Real y)
+    {
+        check_nan(x, y);
+        if (y > m_max_y)
+        {
+            m_max_y = y;
+        }
+        if (y < m_min_y)
+        {
+            m_min_y = y;
+        }
+    }
+
+    // A segment of the graph, with the function evaluated at its midpoint.
+    struct segment
+    {
+        Real x0, y0, xm, ym, x1, y1;
+        Real error;
+
+        bool operator<(segment const & other) const
+        {
+            return error < other.error;
+        }
+    };
+
+    template<class F>
+    void add_fn_adaptive(F & f, std::string const & color)
+    {
+        using std::abs;
+        unsigned evaluations = 0;
+        std::vector<std::pair<Real, Real>> points;
+        auto eval = [&](Real x)->Real
+        {
+            Real y = f(x);
+            ++evaluations;
+            track(x, y);
+            points.emplace_back(x, y);
+            return y;
+        };
+        // The error of the segment's chord at its midpoint, in pixels of the range seen so far.
+        // The final range can only be larger, so this never underestimates the error on screen.
+        auto make_segment = [&](Real x0, Real y0, Real x1, Real y1)->segment
+        {
+            Real xm = (x0 + x1)/2;
+            Real ym = eval(xm);
+            Real deviation = abs(ym - (y0 + y1)/2);
+            Real error = 0;
+            if (deviation > 0)
+            {
+                error = (m_max_y > m_min_y) ? deviation*m_graph_height/(m_max_y - m_min_y) : std::numeric_limits<Real>::max();
+            }
+            return segment{x0, y0, xm, ym, x1, y1, error};
+        };
+
+        Real step = (m_max_x - m_min_x)/(m_samples - static_cast<Real>(1));
+        for (unsigned i = 0; i < m_samples; ++i)
+        {
+            eval(m_min_x + step*i);
+        }
+        std::priority_queue<segment> worst;
+        for (unsigned i = 0; i + 1 < m_samples && evaluations < m_max_evaluations; ++i)
+        {
+            worst.push(make_segment(points[i].first, points[i].second, points[i+1].first, points[i+1].second));
+        }
+        // Segments narrower than a tenth of a pixel are not split further; that's the resolution of compact paths.
+        Real min_width = (m_max_x - m_min_x)/(10*m_graph_width);
+        while (!worst.empty() && evaluations + 2 <= m_max_evaluations)
+        {
+            segment s = worst.top();
+            if (s.error <= m_pixel_tolerance)
+            {
+                break;
+            }
+            worst.pop();
+            if (s.x1 - s.x0 < min_width)
+            {
+                continue;
+            }
+            worst.push(make_segment(s.x0, s.y0, s.xm, s.ym));
+            worst.push(make_segment(s.xm, s.ym, s.x1, s.y1));
+        }
+
+        std::sort(points.begin(), points.end(), [](auto const & a, auto const & b) { return a.first < b.first; });
+        std::vector<Real> x(points.size());
+        std::vector<Real> v(points.size());
+        for (size_t i = 0; i < points.size(); ++i)
+        {
+            x[i] = points[i].first;
+            v[i] = points[i].second;
+        }
+        m_abscissas.emplace_back(std::move(x));
+        m_dataset.emplace_back(std::move(v));
+        m_connect_color.emplace_back(color);
+    }
+
     Real m_min_x;
     Real m_max_x;
     unsigned m_samples;
-    std::ofstream m_fs;
+    detail::svg_buffer m_svg;
+    std::string m_filename;
     Real m_min_y;
     Real m_max_y;
     bool m_is_written;
     std::vector<std::vector<Real>> m_dataset;
+    std::vector<std::vector<Real>> m_abscissas;
     std::vector<std::string> m_connect_color;
     int m_margin_top;
     int m_margin_left;
@@ -204,6 +404,10 @@ private:
     int m_stroke_width;
     int m_horizontal_lines;
     int m_vertical_lines;
+    bool m_compact_paths;
+    Real m_pixel_tolerance;
+    unsigned m_max_evaluations;
+    unsigned m_threads;
 };
 
 } // namespace
@@ -0,0 +1,281 @@
+#ifndef QUICKSVG_LIVE_TIME_SERIES_HPP
+#define QUICKSVG_LIVE_TIME_SERIES_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <quicksvg/detail/generic_svg_functionality.hpp>
+#include <quicksvg/detail/raster.hpp>
+#include <quicksvg/strided_span.hpp>
+
+namespace quicksvg {
+
+// A time series plot for dashboards: keeps the last `window` samples in a ring buffer and rewrites
+// the file on every call to write(). The x-axis is time relative to the newest sample, so the prelude,
+// axes and gridlines only change with the y-range; they are kept serialized and copied verbatim.
+// An automatic y-range is rounded out to gridlines at round numbers and kept while the samples fill enough of it,
+// so it rarely changes between refreshes. Refreshing costs O(window) and reuses the same buffers
+// (and, for bitmaps, the same image) every time. NaN samples are left out of the line.
+template<class Real>
+class live_time_series
+{
+public:
+    live_time_series(Real time_step, size_t window, std::string const & title,
+                     std::string const & filename, int width = 1100, std::string color = "steelblue") :
+                    m_time_step{time_step},
+                    m_filename{filename},
+                    m_color{color},
+                    m_ring(window),
+                    m_head{0},
+                    m_size{0},
+                    m_fixed_range{false},
+                    m_compact_paths{false},
+                    m_lo{0},
+                    m_hi{0},
+                    m_frame_lo{0},
+                    m_frame_hi{0}
+    {
+        if (time_step <= 0)
+        {
+            throw std::domain_error("time_step > 0 is required.");
+        }
+        if (window < 2)
+        {
+            throw std::domain_error("The window must hold at least 2 samples.");
+        }
+        m_margin_top = 40;
+        m_margin_left = 25;
+        m_margin_bottom = 20;
+        m_margin_right = 20;
+
+        int height = static_cast<int>(std::floor(double(width)/1.61803));
+        m_graph_height = height - m_margin_bottom - m_margin_top;
+        m_graph_width = width - m_margin_left - m_margin_right;
+
+        detail::svg_buffer prelude;
+        detail::write_prelude(prelude, title, width, height, m_margin_top);
+        m_prelude = prelude.str();
+        m_ys.resize(window);
+        m_svg.set_sink(detail::raster_sink(filename));
+    }
+
+    // Number of decimals printed for coordinates; 3 by default.
+    void set_precision(int decimals)
+    {
+        m_svg.set_precision(decimals);
+        m_frame.set_precision(decimals);
+        // Rebuilt at the new precision by the next write:
+        m_frame.clear();
+    }
+
+    // Fix the y-axis to [lo, hi], so the axes are serialized once and never again.
+    // By default the y-axis fits the samples in the window, and the axes are rebuilt whenever that range changes.
+    void set_y_range(Real lo, Real hi)
+    {
+        if (!(lo < hi))
+        {
+            throw std::domain_error("The y-range must satisfy lo < hi.");
+        }
+        m_fixed_range = true;
+        m_lo = lo;
+        m_hi = hi;
+    }
+
+    // Writes paths in the compact encoding of detail::path_writer.
+    void set_compact_paths(bool compact)
+    {
+        m_compact_paths = compact;
+    }
+
+    // Appends a sample, dropping the oldest once the window is full.
+    void push(Real y)
+    {
+        m_ring[m_head] = y;
+        m_head = (m_head + 1) % m_ring.size();
+        m_size = std::min(m_size + 1, m_ring.size());
+    }
+
+    void push(strided_span<Real> chunk)
+    {
+        // Only the last window samples of a long chunk survive:
+        size_t skip = chunk.size() > m_ring.size() ? chunk.size() - m_ring.size() : 0;
+        for (size_t i = skip; i < chunk.size(); ++i)
+        {
+            push(chunk[i]);
+        }
+    }
+
+    void push(std::vector<Real> const & chunk)
+    {
+        push(strided_span<Real>(chunk));
+    }
+
+    // Number of samples in the window.
+    size_t size() const
+    {
+        return m_size;
+    }
+
+    // Writes the current window to the file; may be called any number of times.
+    void write()
+    {
+        // The window is at most two contiguous pieces of the ring, oldest first:
+        size_t first = (m_head + m_ring.size() - m_size) % m_ring.size();
+        size_t n1 = std::min(m_size, m_ring.size() - first);
+        size_t n2 = m_size - n1;
+
+        Real lo = m_lo;
+        Real hi = m_hi;
+        if (!m_fixed_range)
+        {
+            if (m_size == 0)
+            {
+                throw std::logic_error("There are no samples to write, and no fixed y-range to draw.");
+            }
+            lo = std::numeric_limits<Real>::max();
+            hi = std::numeric_limits<Real>::lowest();
+            detail::minmax(m_ring.data() + first, n1, 1, lo, hi);
+            detail::minmax(m_ring.data(), n2, 1, lo, hi);
+            bool framed = !m_frame.str().empty();
+            if (lo > hi)
+            {
+                // Every sample is NaN, so there is nothing to fit; keep the current frame, or else show [-1, 1]:
+                lo = framed ? m_frame_lo : Real(0);
+                hi = framed ? m_frame_hi : Real(0);
+            }
+            if (lo == hi)
+            {
+                // A single sample, or a flat window, has no extent to scale; give it one of its own magnitude:
+                using std::abs;
+                Real pad = (lo == 0) ? Real(1) : Real(abs(lo)/2);
+                lo -= pad;
+                hi += pad;
+            }
+            if (framed && m_frame_lo <= lo && hi <= m_frame_hi && 4*(hi - lo) >= m_frame_hi - m_frame_lo)
+            {
+                lo = m_frame_lo;
+                hi = m_frame_hi;
+            }
+            else
+            {
+                round_out(lo, hi);
+            }
+        }
+        if (m_frame.str().empty() || lo != m_frame_lo || hi != m_frame_hi)
+        {
+            write_frame(lo, hi);
+        }
+
+        m_svg.clear();
+        m_svg << m_prelude << m_frame.str();
+        detail::axis_map<Real> y_scale(lo, hi, m_graph_height, true);
+        y_scale.transform(m_ring.data() + first, n1, 1, m_ys.data());
+        y_scale.transform(m_ring.data(), n2, 1, m_ys.data() + n1);
+        // The newest sample is at the right edge:
+        double step = double(m_graph_width)/(m_ring.size() - 1);
+        size_t offset = m_ring.size() - m_size;
+        detail::path_writer path(m_svg, m_compact_paths, m_color, 1);
+        bool pen = false;
+        for (size_t k = 0; k < m_size; ++k)
+        {
+            using std::isnan;
+            if (isnan(m_ys[k]))
+            {
+                pen = false;
+            }
+            else if (pen)
+            {
+                path.line_to((offset + k)*step, m_ys[k]);
+            }
+            else
+            {
+                path.move_to((offset + k)*step, m_ys[k]);
+                pen = true;
+            }
+        }
+        path.close();
+        m_svg << "</g>\n"
+              << "</svg>\n";
+        m_svg.write_to(m_filename);
+    }
+
+private:
+    // Widens [lo, hi] to the 8 gridline intervals of write_frame, each 1, 2, 2.5 or 5 times a power of ten.
+    static void round_out(Real & lo, Real & hi)
+    {
+        double l = static_cast<double>(lo);
+        double h = static_cast<double>(hi);
+        double magnitude = std::pow(10.0, std::floor(std::log10((h - l)/8)));
+        if (!(magnitude > 0 && std::isfinite(magnitude)))
+        {
+            return;
+        }
+        for (double m : {1.0, 2.0, 2.5, 5.0, 10.0, 20.0, 25.0, 50.0})
+        {
+            double step = m*magnitude;
+            double bottom = std::floor(l/step)*step;
+            if (bottom + 8*step >= h)
+            {
+                // Rounding in double must not cut off a sample:
+                lo = std::min<Real>(lo, Real(bottom));
+                hi = std::max<Real>(hi, Real(bottom + 8*step));
+                return;
+            }
+        }
+    }
+
+    // Serializes the group, axes and gridlines for a y-range of [lo, hi].
+    void write_frame(Real lo, Real hi)
+    {
+        Real oldest = -m_time_step*(m_ring.size() - 1);
+        detail::axis_map<Real> x_scale(oldest, Real(0), m_graph_width);
+        detail::axis_map<Real> y_scale(lo, hi, m_graph_height, true);
+        m_frame.clear();
+        m_frame << "<g transform='translate(" << m_margin_left << ", " << m_margin_top << ")'>\n";
+        m_frame << "<line x1='0' y1='0' x2='0' y2='" << m_graph_height
+                << "' stroke='gray' stroke-width='1' />\n";
+        double x_axis_loc = m_graph_height;
+        if (lo <= 0 && hi >= 0)
+        {
+            x_axis_loc = y_scale(0);
+        }
+        m_frame << "<line x1='0' y1='" << x_axis_loc
+                << "' x2='" << m_graph_width << "' y2='" << x_axis_loc
+                << "' stroke='gray' stroke-width='1' />\n";
+        detail::write_gridlines(m_frame, 8, 10, x_scale, y_scale, oldest, Real(0),
+                                lo, hi, m_graph_width, m_graph_height, m_margin_left);
+        m_frame_lo = lo;
+        m_frame_hi = hi;
+    }
+
+    Real m_time_step;
+    std::string m_filename;
+    std::string m_color;
+    std::vector<Real> m_ring;
+    // Next slot to write, and number of valid samples:
+    size_t m_head;
+    size_t m_size;
+    bool m_fixed_range;
+    bool m_compact_paths;
+    Real m_lo;
+    Real m_hi;
+    // Serialized once, and again whenever the y-range changes:
+    std::string m_prelude;
+    detail::svg_buffer m_frame;
+    Real m_frame_lo;
+    Real m_frame_hi;
+    std::vector<double> m_ys;
+    detail::svg_buffer m_svg;
+    int m_margin_top;
+    int m_margin_left;
+    int m_margin_bottom;
+    int m_margin_right;
+    int m_graph_width;
+    int m_graph_height;
+};
+
+} // namespace
+#endif
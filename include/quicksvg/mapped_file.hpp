@@ -0,0 +1,359 @@
+#ifndef QUICKSVG_MAPPED_FILE_HPP
+#define QUICKSVG_MAPPED_FILE_HPP
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <clocale>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+#if defined __has_include
+#  if !__has_include(<sys/mman.h>)
+#    error "quicksvg/mapped_file.hpp maps files with POSIX mmap, which this platform does not provide."
+#  endif
+#endif
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <quicksvg/strided_span.hpp>
+#include <quicksvg/detail/parallel_for.hpp>
+
+namespace quicksvg {
+
+// A read-only memory map of a whole file.
+// Pages are read on demand, so mapping a multi-gigabyte capture costs nothing until the plot touches it.
+class mapped_file
+{
+public:
+    explicit mapped_file(std::string const & filename) : m_data{nullptr}, m_size{0}
+    {
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            throw std::domain_error("Cannot open " + filename + ": " + std::strerror(errno));
+        }
+        struct stat st;
+        if (::fstat(fd, &st) != 0)
+        {
+            int error = errno;
+            ::close(fd);
+            throw std::domain_error("Cannot stat " + filename + ": " + std::strerror(error));
+        }
+        m_size = static_cast<size_t>(st.st_size);
+        // mmap rejects empty mappings; an empty file is just an empty range.
+        if (m_size > 0)
+        {
+            void * p = ::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED)
+            {
+                int error = errno;
+                ::close(fd);
+                throw std::domain_error("Cannot map " + filename + ": " + std::strerror(error));
+            }
+            // The plots read the data front to back:
+            ::madvise(p, m_size, MADV_SEQUENTIAL);
+            m_data = static_cast<char const *>(p);
+        }
+        ::close(fd);
+    }
+
+    mapped_file(mapped_file const &) = delete;
+    mapped_file & operator=(mapped_file const &) = delete;
+
+    mapped_file(mapped_file && other) noexcept : m_data{other.m_data}, m_size{other.m_size}
+    {
+        other.m_data = nullptr;
+        other.m_size = 0;
+    }
+
+    mapped_file & operator=(mapped_file && other) noexcept
+    {
+        if (this != &other)
+        {
+            unmap();
+            m_data = other.m_data;
+            m_size = other.m_size;
+            other.m_data = nullptr;
+            other.m_size = 0;
+        }
+        return *this;
+    }
+
+    ~mapped_file()
+    {
+        unmap();
+    }
+
+    char const * data() const
+    {
+        return m_data;
+    }
+
+    size_t size() const
+    {
+        return m_size;
+    }
+
+private:
+    void unmap()
+    {
+        if (m_data)
+        {
+            ::munmap(const_cast<char *>(m_data), m_size);
+        }
+    }
+
+    char const * m_data;
+    size_t m_size;
+};
+
+// A file of raw little-endian float or double, read as records of `fields` values each
+// (fields = 2 for interleaved (x, y) pairs, say). Columns are views of the mapping, so passing them to
+// add_dataset copies nothing; the mapped_array must outlive the plot's write_all.
+template<class Real>
+class mapped_array
+{
+public:
+    static_assert(std::is_same<Real, float>::value || std::is_same<Real, double>::value,
+                  "Raw binary files hold float or double.");
+
+    explicit mapped_array(std::string const & filename, size_t fields = 1) : m_file{filename}, m_fields{fields}
+    {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        throw std::domain_error("mapped_array reads little-endian data in place; this platform is big-endian.");
+#endif
+        if (m_fields == 0)
+        {
+            throw std::domain_error("A record must have at least one field.");
+        }
+        if (m_file.size() % (sizeof(Real)*m_fields) != 0)
+        {
+            throw std::domain_error(filename + " is " + std::to_string(m_file.size())
+                                    + " bytes, which is not a whole number of " + std::to_string(m_fields)
+                                    + "-field records of " + std::to_string(sizeof(Real)) + " byte values.");
+        }
+    }
+
+    size_t records() const
+    {
+        return m_file.size()/(sizeof(Real)*m_fields);
+    }
+
+    strided_span<Real> column(size_t field = 0) const
+    {
+        if (field >= m_fields)
+        {
+            throw std::domain_error("Field " + std::to_string(field) + " requested from records of "
+                                    + std::to_string(m_fields) + " fields.");
+        }
+        // The mapping is page aligned, so the values are naturally aligned:
+        auto data = reinterpret_cast<Real const *>(m_file.data());
+        return strided_span<Real>(data ? data + field : nullptr, records(), m_fields);
+    }
+
+private:
+    mapped_file m_file;
+    size_t m_fields;
+};
+
+namespace detail {
+
+// strtod and friends read the decimal point of the C library's locale, which may be ','; CSV files use '.'.
+// The '.' is swapped for the locale's before calling strto, and the end pointer mapped back.
+template<class Real, class Strto>
+void parse_c_locale(char const * s, char ** end, Real & x, Strto strto)
+{
+    char const * point = std::localeconv()->decimal_point;
+    char const * dot = std::strchr(s, '.');
+    if (dot == nullptr || std::strcmp(point, ".") == 0)
+    {
+        x = strto(s, end);
+        return;
+    }
+    std::string localized(s, dot);
+    localized += point;
+    localized += dot + 1;
+    char * stop;
+    x = strto(localized.c_str(), &stop);
+    size_t n = stop - localized.c_str();
+    size_t dot_index = dot - s;
+    size_t point_size = std::strlen(point);
+    *end = const_cast<char *>(s + (n >= dot_index + point_size ? n - point_size + 1 : std::min(n, dot_index)));
+}
+
+// Parses with from_chars where the library has it for floating point, which ignores the locale.
+// It rejects a leading '+', and reports values beyond the type's range, which strtod rounds to infinity or zero;
+// both are left to parse_c_locale.
+template<class Real, class Strto>
+void parse_floating(char const * s, char ** end, Real & x, Strto strto)
+{
+#ifdef __cpp_lib_to_chars
+    auto result = std::from_chars(s, s + std::strlen(s), x);
+    if (result.ec == std::errc())
+    {
+        *end = const_cast<char *>(result.ptr);
+        return;
+    }
+#endif
+    parse_c_locale(s, end, x, strto);
+}
+
+inline void parse_number(char const * s, char ** end, float & x)
+{
+    parse_floating(s, end, x, [](char const * p, char ** e) { return std::strtof(p, e); });
+}
+
+inline void parse_number(char const * s, char ** end, double & x)
+{
+    parse_floating(s, end, x, [](char const * p, char ** e) { return std::strtod(p, e); });
+}
+
+inline void parse_number(char const * s, char ** end, long double & x)
+{
+    parse_floating(s, end, x, [](char const * p, char ** e) { return std::strtold(p, e); });
+}
+
+// Multiprecision types parse their own strings, and throw on malformed input:
+template<class Real>
+void parse_number(char const * s, char ** end, Real & x)
+{
+    x = Real(s);
+    *end = const_cast<char *>(s + std::strlen(s));
+}
+
+inline bool is_blank(std::string_view line)
+{
+    return line.find_first_not_of(" \t\r") == std::string_view::npos;
+}
+
+} // namespace detail
+
+// Parses the given columns (0-based) of a CSV file, one vector per requested column.
+// The file is mapped and split into `threads` byte ranges at line boundaries, which are parsed concurrently
+// straight into the result: one pass counts the rows of each range, a second parses them in place.
+// Blank lines are skipped; if header is true, the first line is too.
+template<class Real>
+std::vector<std::vector<Real>> load_csv_columns(std::string const & filename, std::vector<size_t> const & columns,
+                                                bool header = false, unsigned threads = 0, char delimiter = ',')
+{
+    mapped_file file(filename);
+    std::string_view text(file.data(), file.size());
+    size_t start = 0;
+    if (header)
+    {
+        start = std::min(text.find('\n'), text.size());
+        start = std::min(start + 1, text.size());
+    }
+    std::string_view body = text.substr(start);
+
+    // slot[c] is the position in the result of file column c, or -1:
+    size_t max_column = 0;
+    for (size_t c : columns)
+    {
+        max_column = std::max(max_column, c);
+    }
+    std::vector<long> slot(max_column + 1, -1);
+    for (size_t k = 0; k < columns.size(); ++k)
+    {
+        if (slot[columns[k]] >= 0)
+        {
+            throw std::domain_error("Column " + std::to_string(columns[k]) + " is requested twice.");
+        }
+        slot[columns[k]] = static_cast<long>(k);
+    }
+
+    // Calls f(line) for each line starting in [begin, end) of body, without its newline.
+    auto for_each_line = [&](size_t begin, size_t end, auto f)
+    {
+        size_t p = begin;
+        if (p > 0 && body[p - 1] != '\n')
+        {
+            p = body.find('\n', p);
+            p = (p == std::string_view::npos) ? body.size() : p + 1;
+        }
+        while (p < end)
+        {
+            size_t q = body.find('\n', p);
+            if (q == std::string_view::npos)
+            {
+                q = body.size();
+            }
+            std::string_view line = body.substr(p, q - p);
+            if (!detail::is_blank(line))
+            {
+                f(line);
+            }
+            p = q + 1;
+        }
+    };
+
+    size_t chunks = detail::chunk_count(body.size(), threads);
+    std::vector<size_t> rows(chunks + 1, 0);
+    detail::parallel_for(body.size(), threads, [&](size_t chunk, size_t begin, size_t end)
+    {
+        for_each_line(begin, end, [&](std::string_view) { ++rows[chunk + 1]; });
+    });
+    for (size_t chunk = 0; chunk < chunks; ++chunk)
+    {
+        rows[chunk + 1] += rows[chunk];
+    }
+
+    std::vector<std::vector<Real>> result(columns.size(), std::vector<Real>(rows[chunks]));
+    detail::parallel_for(body.size(), threads, [&](size_t chunk, size_t begin, size_t end)
+    {
+        size_t row = rows[chunk];
+        std::string field;
+        for_each_line(begin, end, [&](std::string_view line)
+        {
+            size_t found = 0;
+            size_t c = 0;
+            size_t p = 0;
+            while (c <= max_column && p <= line.size())
+            {
+                size_t q = std::min(line.find(delimiter, p), line.size());
+                if (slot[c] >= 0)
+                {
+                    std::string_view s = line.substr(p, q - p);
+                    size_t first = s.find_first_not_of(" \t\r\"");
+                    size_t last = s.find_last_not_of(" \t\r\"");
+                    field.assign(first == std::string_view::npos ? std::string_view() : s.substr(first, last - first + 1));
+                    char * stop = nullptr;
+                    Real x;
+                    detail::parse_number(field.c_str(), &stop, x);
+                    if (field.empty() || stop != field.c_str() + field.size())
+                    {
+                        throw std::domain_error("Cannot parse '" + field + "' in column " + std::to_string(c)
+                                                + " of data row " + std::to_string(row + 1) + " of " + filename + ".");
+                    }
+                    result[slot[c]][row] = x;
+                    ++found;
+                }
+                ++c;
+                p = q + 1;
+            }
+            if (found != columns.size())
+            {
+                throw std::domain_error("Data row " + std::to_string(row + 1) + " of " + filename + " has only "
+                                        + std::to_string(c) + " columns.");
+            }
+            ++row;
+        });
+    });
+    return result;
+}
+
+template<class Real>
+std::vector<Real> load_csv_column(std::string const & filename, size_t column, bool header = false,
+                                  unsigned threads = 0, char delimiter = ',')
+{
+    return std::move(load_csv_columns<Real>(filename, {column}, header, threads, delimiter)[0]);
+}
+
+} // namespace
+#endif
@@ -3,11 +3,18 @@
 
 #include <cassert>
 #include <vector>
+#include <list>
 #include <string>
 #include <utility>
 #include <fstream>
+#include <functional>
 #include <algorithm>
+#include <iterator>
 #include <quicksvg/detail/generic_svg_functionality.hpp>
+#include <quicksvg/detail/canvas.hpp>
+#include <quicksvg/detail/m4.hpp>
+#include <quicksvg/detail/raster.hpp>
+#include <quicksvg/strided_span.hpp>
 
 namespace quicksvg {
 
@@ -18,17 +25,27 @@ public:
     plot_time_series(Real start_time, Real time_step, std::string const & title,
                      std::string const & filename, int width = 1100) :
                     m_start_time{start_time},
+                    m_first_time{std::numeric_limits<Real>::max()},
                     m_end_time{std::numeric_limits<Real>::lowest()},
                     m_time_step{time_step},
                     m_min_y{std::numeric_limits<Real>::max()},
                     m_max_y{std::numeric_limits<Real>::lowest()},
-                    m_is_written{false}
+                    m_is_written{false},
+                    m_decimate{false},
+                    m_compact_paths{false},
+                    m_packed_markers{false},
+                    m_html{detail::is_html(filename)},
+                    m_windowed{false},
+                    m_t0{0},
+                    m_t1{0},
+                    m_max_gap{std::numeric_limits<Real>::max()}
 
     {
         if (time_step <= 0) {
             throw std::domain_error("time_step > 0 is required.");
         }
-        m_fs.open(filename);
+        m_filename = filename;
+        m_title = title;
 
         m_margin_top = 40;
         m_margin_left = 25;
@@ -39,37 +56,216 @@ public:
         m_graph_height = height - m_margin_bottom - m_margin_top;
         m_graph_width = width - m_margin_left - m_margin_right;
 
-        detail::write_prelude(m_fs, title, width, height, m_margin_top);
+        m_svg.set_sink(detail::raster_sink(filename));
+        detail::write_prelude(m_svg, title, width, height, m_margin_top);
+    }
+
+    // Draw only the first, last, minimum and maximum sample of each pixel column, line and dots.
+    // The line looks the same, and the output grows with the width rather than the length of the data.
+    void set_decimation(bool decimate)
+    {
+        m_decimate = decimate;
+    }
+
+    // Number of decimals printed for coordinates; 3 by default.
+    void set_precision(int decimals)
+    {
+        m_svg.set_precision(decimals);
+    }
+
+    // Writes paths in the compact encoding of detail::path_writer.
+    void set_compact_paths(bool compact)
+    {
+        m_compact_paths = compact;
+    }
+
+    // Draw all dots of a dataset as one <path> of round-capped zero-length segments instead of a <circle> per point.
+    void set_packed_markers(bool packed)
+    {
+        m_packed_markers = packed;
+    }
+
+    // Samples of timestamped datasets more than max_gap apart are not connected.
+    void set_max_gap(Real max_gap)
+    {
+        if (!(max_gap > 0))
+        {
+            throw std::domain_error("max_gap > 0 is required.");
+        }
+        m_max_gap = max_gap;
     }
 
     void add_dataset(std::vector<Real> const & v, bool connect_the_dots = true,
                      std::string connect_color = "steelblue", std::string dot_color="orange")
+    {
+        add_dataset(std::vector<Real>(v), connect_the_dots, connect_color, dot_color);
+    }
+
+    // Takes ownership of the data without copying it.
+    void add_dataset(std::vector<Real> && v, bool connect_the_dots = true,
+                     std::string connect_color = "steelblue", std::string dot_color="orange")
     {
         if (m_is_written)
         {
             throw std::logic_error("Cannot add data to graph after writing it.\n");
         }
+        m_owned.push_back(std::move(v));
+        add_dataset(strided_span<Real>(m_owned.back()), connect_the_dots, connect_color, dot_color);
+    }
 
-        auto result = std::minmax_element(v.begin(), v.end());
-        if (*result.first < m_min_y)
+    // Borrows the data; it must stay alive and unchanged until write_all returns.
+    void add_dataset(strided_span<Real> v, bool connect_the_dots = true,
+                     std::string connect_color = "steelblue", std::string dot_color="orange")
+    {
+        if (m_is_written)
         {
-            m_min_y = *result.first;
+            throw std::logic_error("Cannot add data to graph after writing it.\n");
         }
-        if (*result.second > m_max_y)
+
+        extend_time(m_start_time, m_start_time + m_time_step*(v.size() - 1));
+        m_connect.push_back(connect_the_dots);
+        m_connect_color.push_back(connect_color);
+        m_dot_color.push_back(dot_color);
+        m_dataset.push_back(v);
+        m_times.push_back(strided_span<Real>(nullptr, 0));
+        m_stream_of.push_back(-1);
+    }
+
+    // A dataset sampled at irregular times: v[j] is taken at times[j].
+    // start_time and time_step don't apply; the times must be nondecreasing.
+    void add_dataset(std::vector<Real> const & times, std::vector<Real> const & v, bool connect_the_dots = true,
+                     std::string connect_color = "steelblue", std::string dot_color="orange")
+    {
+        add_dataset(std::vector<Real>(times), std::vector<Real>(v), connect_the_dots, connect_color, dot_color);
+    }
+
+    void add_dataset(std::vector<Real> && times, std::vector<Real> && v, bool connect_the_dots = true,
+                     std::string connect_color = "steelblue", std::string dot_color="orange")
+    {
+        if (m_is_written)
         {
-            m_max_y = *result.second;
+            throw std::logic_error("Cannot add data to graph after writing it.\n");
         }
+        m_owned.push_back(std::move(times));
+        strided_span<Real> t(m_owned.back());
+        m_owned.push_back(std::move(v));
+        add_dataset(t, strided_span<Real>(m_owned.back()), connect_the_dots, connect_color, dot_color);
+    }
 
-        Real end_time = m_start_time + m_time_step*(v.size() - 1);
-        if (end_time > m_end_time)
+    // Borrows both arrays. The ordering is checked here, once; write_all relies on it
+    // to bucket by pixel column and to find the viewport by binary search.
+    void add_dataset(strided_span<Real> times, strided_span<Real> v, bool connect_the_dots = true,
+                     std::string connect_color = "steelblue", std::string dot_color="orange")
+    {
+        if (m_is_written)
+        {
+            throw std::logic_error("Cannot add data to graph after writing it.\n");
+        }
+        if (times.size() != v.size())
         {
-            m_end_time = end_time;
+            throw std::domain_error("There are " + std::to_string(times.size()) + " timestamps for "
+                                    + std::to_string(v.size()) + " samples.");
+        }
+        for (size_t j = 0; j < times.size(); ++j)
+        {
+            // Also rejects NaN:
+            if (!(j == 0 ? times[j] == times[j] : times[j] >= times[j-1]))
+            {
+                throw std::domain_error("Timestamps must be nondecreasing; timestamp " + std::to_string(j)
+                                        + " is out of order.");
+            }
+        }
+        if (times.size() > 0)
+        {
+            extend_time(times[0], times[times.size() - 1]);
         }
         m_connect.push_back(connect_the_dots);
         m_connect_color.push_back(connect_color);
         m_dot_color.push_back(dot_color);
         m_dataset.push_back(v);
+        m_times.push_back(times);
+        m_stream_of.push_back(-1);
+    }
+
+    // Starts a dataset of total_samples samples that arrives in chunks through append(id, chunk); returns its id.
+    // Samples are folded into the first, last, minimum and maximum of each pixel column as they arrive,
+    // so memory is O(width) however long the recording is; it is drawn as set_decimation(true) draws a dataset.
+    // The dataset spans [start_time, start_time + (total_samples - 1)*time_step], whether or not every sample arrives.
+    // The columns are those of the x-range known now: the viewport if one is set, or else the span of this and the
+    // datasets added so far. A dataset added later that widens the x-range shifts the pixel columns; the stream's
+    // retained samples are then folded into the new columns, which can misplace an extreme by a pixel.
+    // Add the longest datasets first, or set the viewport, to get exactly the columns write_all uses.
+    size_t begin_stream(size_t total_samples, bool connect_the_dots = true,
+                        std::string connect_color = "steelblue", std::string dot_color="orange")
+    {
+        if (m_is_written)
+        {
+            throw std::logic_error("Cannot add data to graph after writing it.\n");
+        }
+        if (total_samples == 0)
+        {
+            throw std::domain_error("A stream must have at least one sample.");
+        }
+        extend_time(m_start_time, m_start_time + m_time_step*(total_samples - 1));
+        auto x_range = visible_time();
+        auto placement = sample_placement(x_range.first, x_range.second);
+        m_streams.push_back(stream{total_samples, 0, window(total_samples, strided_span<Real>(nullptr, 0)),
+                                   x_range.first, x_range.second, placement.first, placement.second,
+                                   detail::m4_columns<Real>(m_graph_width)});
+        m_connect.push_back(connect_the_dots);
+        m_connect_color.push_back(connect_color);
+        m_dot_color.push_back(dot_color);
+        m_dataset.push_back(strided_span<Real>(nullptr, 0));
+        m_times.push_back(strided_span<Real>(nullptr, 0));
+        m_stream_of.push_back(static_cast<long>(m_streams.size() - 1));
+        return m_streams.size() - 1;
+    }
+
+    // Folds the next chunk of samples into stream id. The chunk is not retained.
+    void append(size_t id, strided_span<Real> chunk)
+    {
+        if (m_is_written)
+        {
+            throw std::logic_error("Cannot add data to graph after writing it.\n");
+        }
+        if (id >= m_streams.size())
+        {
+            throw std::domain_error("No stream with id " + std::to_string(id) + ".");
+        }
+        stream & s = m_streams[id];
+        if (chunk.size() > s.total - s.received)
+        {
+            throw std::domain_error("The stream was declared with " + std::to_string(s.total)
+                                    + " samples; appending " + std::to_string(chunk.size())
+                                    + " more would exceed it.");
+        }
+        // Samples outside the viewport are never drawn:
+        size_t begin = std::max(s.window.first, s.received);
+        size_t end = std::min(s.window.second, s.received + chunk.size());
+        for (size_t j = begin; j < end; ++j)
+        {
+            s.columns.add(column(s.x0 + j*s.step), j, chunk[j - s.received]);
+        }
+        s.received += chunk.size();
+    }
 
+    void append(size_t id, std::vector<Real> const & chunk)
+    {
+        append(id, strided_span<Real>(chunk));
+    }
+
+    // Render only [t0, t1]: the x-axis spans the viewport and the y-axis the samples inside it.
+    // The visible samples are found by index arithmetic, so the cost is proportional to the window,
+    // not to the length of the recording.
+    void set_viewport(Real t0, Real t1)
+    {
+        if (!(t0 < t1))
+        {
+            throw std::domain_error("The viewport must satisfy t0 < t1.");
+        }
+        m_windowed = true;
+        m_t0 = t0;
+        m_t1 = t1;
     }
 
     void write_all()
@@ -78,89 +274,588 @@ public:
         {
             throw std::logic_error("Data is already written to the svg.\n");
         }
+        auto x_range = visible_time();
+        Real lo_x = x_range.first;
+        Real hi_x = x_range.second;
+
+        // The visible samples of each dataset: an index range of the data,
+        // or for streams the retained samples inside the window.
+        std::vector<std::pair<size_t, size_t>> windows(m_connect.size());
+        std::vector<std::vector<size_t>> stream_indices(m_connect.size());
+        std::vector<std::vector<Real>> stream_values(m_connect.size());
+        size_t visible = 0;
+        for (size_t i = 0; i < m_connect.size(); ++i)
+        {
+            if (m_stream_of[i] >= 0)
+            {
+                auto const & s = m_streams[m_stream_of[i]];
+                auto range = window(s.received, strided_span<Real>(nullptr, 0));
+                auto keep = [&](size_t j, Real y)
+                {
+                    if (j >= range.first && j < range.second)
+                    {
+                        stream_indices[i].push_back(j);
+                        stream_values[i].push_back(y);
+                    }
+                };
+                if (s.lo_x == lo_x && s.hi_x == hi_x)
+                {
+                    s.columns.for_each(keep);
+                }
+                else
+                {
+                    // The x-range grew after begin_stream, so the columns moved:
+                    auto placement = sample_placement(lo_x, hi_x);
+                    detail::m4_columns<Real> columns(m_graph_width);
+                    s.columns.for_each([&](size_t j, Real y) { columns.add(column(placement.first + j*placement.second), j, y); });
+                    columns.for_each(keep);
+                }
+                auto const & values = stream_values[i];
+                detail::minmax(values.data(), values.size(), 1, m_min_y, m_max_y);
+                visible += values.size();
+                continue;
+            }
+            auto const & v = m_dataset[i];
+            windows[i] = window(v.size(), m_times[i]);
+            size_t begin = windows[i].first;
+            detail::minmax(v.data() + begin*v.stride(), windows[i].second - begin, v.stride(), m_min_y, m_max_y);
+            visible += windows[i].second - begin;
+        }
+        if (m_windowed && visible == 0)
+        {
+            throw std::domain_error("No samples fall in the viewport.");
+        }
+
         // Maps [a,b] to [0, graph_width]
-        auto x_scale = [this](Real x)->Real
+        detail::axis_map<Real> x_scale(lo_x, hi_x, m_graph_width);
+        detail::axis_map<Real> y_scale(m_min_y, m_max_y, m_graph_height, true);
+        // Consecutive samples are step pixels apart:
+        double step = static_cast<double>(m_time_step)*x_scale.scale();
+
+        write_frame(x_scale, y_scale, lo_x, hi_x);
+
+        // Screen coordinates of the visible part of the current dataset:
+        std::vector<double> xs;
+        std::vector<double> ys;
+        for (size_t i = 0; i < m_connect.size(); ++i)
         {
-            return ((x-m_start_time)/(m_end_time- m_start_time))*static_cast<Real>(m_graph_width);
-        };
+            bool connect_the_dots = m_connect[i];
+            std::string const & stroke = m_connect_color[i];
+            std::string const & dot_color = m_dot_color[i];
+            if (m_stream_of[i] >= 0)
+            {
+                // Only the retained samples exist; ys is indexed like them rather than by sample index.
+                auto const & indices = stream_indices[i];
+                auto const & values = stream_values[i];
+                double x0 = x_scale(m_start_time);
+                ys.resize(values.size());
+                y_scale.transform(values.data(), values.size(), 1, ys.data());
+                write_dataset(indices.size(), [&](size_t k) { return x0 + indices[k]*step; },
+                              [&](size_t k) { return ys[k]; }, [](size_t) { return true; }, 0,
+                              connect_the_dots, stroke, dot_color);
+                continue;
+            }
+            auto const & v = m_dataset[i];
+            auto const & t = m_times[i];
+            bool timed = t.size() > 0;
+            size_t begin = windows[i].first;
+            size_t n = windows[i].second - begin;
+            // Sample begin + j is at xs[j] if timestamped, and x0 + j*step otherwise:
+            double x0 = x_scale(m_start_time + m_time_step*begin);
+            if (timed)
+            {
+                xs.resize(n);
+                x_scale.transform(t.data() + begin*t.stride(), n, t.stride(), xs.data());
+            }
+            auto x = [&](size_t j) { return timed ? xs[j] : x0 + j*step; };
+            ys.resize(n);
+            y_scale.transform(v.data() + begin*v.stride(), n, v.stride(), ys.data());
+            auto y = [&](size_t j) { return ys[j]; };
+            if (!m_decimate)
+            {
+                auto joined = [&](size_t j)
+                {
+                    return !timed || !(t[begin + j] - t[begin + j - 1] > m_max_gap);
+                };
+                // Every sample of an evenly spaced dataset is drawn, so they are step apart on screen:
+                write_dataset(n, x, y, joined, timed ? 0 : step, connect_the_dots, stroke, dot_color);
+                continue;
+            }
+
+            // Offsets from begin of the samples on the decimated line:
+            std::vector<size_t> indices;
+            detail::m4_columns<Real> columns(m_graph_width);
+            // Both ends of every gap are kept, so that the path can be broken there:
+            std::vector<size_t> gap_ends;
+            for (size_t j = 0; j < n; ++j)
+            {
+                columns.add(column(x(j)), j, v[begin + j]);
+                if (timed && j > 0 && t[begin + j] - t[begin + j - 1] > m_max_gap)
+                {
+                    gap_ends.push_back(j - 1);
+                    gap_ends.push_back(j);
+                }
+            }
+            columns.for_each([&](size_t j, Real) { indices.push_back(j); });
+            if (!gap_ends.empty())
+            {
+                std::vector<size_t> merged;
+                std::merge(indices.begin(), indices.end(), gap_ends.begin(), gap_ends.end(), std::back_inserter(merged));
+                merged.erase(std::unique(merged.begin(), merged.end()), merged.end());
+                indices.swap(merged);
+            }
+            // Retained samples that aren't adjacent have no gap between them, since gap ends are always retained:
+            auto joined = [&](size_t k)
+            {
+                size_t j = indices[k];
+                return !timed || j - indices[k-1] > 1 || !(t[begin + j] - t[begin + j - 1] > m_max_gap);
+            };
+            write_dataset(indices.size(), [&](size_t k) { return x(indices[k]); },
+                          [&](size_t k) { return ys[indices[k]]; }, joined, 0, connect_the_dots, stroke, dot_color);
+        }
+
+        m_svg << "</g>\n"
+            << "</svg>\n";
+        write_file(m_filename);
+
+        m_is_written = true;
 
-        auto y_scale = [this](Real y)-> Real
+    }
+
+    // Writes a pyramid of tiles for zoomable viewers instead of a single plot, and an index describing it.
+    // Level 0 has one pixel column per samples_per_column samples; each level above halves the resolution,
+    // up to a level whose single tile holds everything. Every tile is graph-width columns wide and
+    // shares the y-range of the whole data, so neighbouring tiles line up.
+    // For a filename of "year.svg", tile t of level l is "year_l_t.svg" and the index is "year.json";
+    // the extension picks the format of the tiles, as for write_all.
+    // The levels are built bottom-up in one pass over the data: a tile is written as soon as it is complete
+    // and its columns are merged into the level above, so the memory is one tile of M4 buckets per level.
+    // Datasets must be evenly spaced and held in memory (not streams or timestamped); the viewport is ignored.
+    void write_tiles(size_t samples_per_column = 1)
+    {
+        if (m_is_written)
+        {
+            throw std::logic_error("Data is already written to the svg.\n");
+        }
+        if (samples_per_column == 0)
+        {
+            throw std::domain_error("samples_per_column > 0 is required.");
+        }
+        size_t samples = 0;
+        for (size_t i = 0; i < m_dataset.size(); ++i)
+        {
+            if (m_stream_of[i] >= 0 || m_times[i].size() > 0)
+            {
+                throw std::domain_error("Tiles can only be made of evenly spaced datasets added with add_dataset.");
+            }
+            auto const & v = m_dataset[i];
+            detail::minmax(v.data(), v.size(), v.stride(), m_min_y, m_max_y);
+            samples = std::max(samples, v.size());
+        }
+        if (samples == 0)
+        {
+            throw std::domain_error("There is no data to tile.");
+        }
+        size_t width = static_cast<size_t>(m_graph_width);
+        size_t columns = (samples + samples_per_column - 1)/samples_per_column;
+        size_t top = 0;
+        while (((columns - 1) >> top) + 1 > width)
         {
-          return ((m_max_y - y)/(m_max_y - m_min_y) )*static_cast<Real>(m_graph_height);
+            ++top;
+        }
+
+        // The tile of each level being filled, and its buckets, one m4_columns per dataset:
+        std::vector<size_t> tile(top + 1, 0);
+        std::vector<std::vector<detail::m4_columns<Real>>> levels(top + 1,
+            std::vector<detail::m4_columns<Real>>(m_dataset.size(), detail::m4_columns<Real>(width)));
+        // "out.d/year.svg" is split into "out.d/", "year" and ".svg"; a dot before the last slash is not an extension.
+        size_t base = m_filename.rfind('/');
+        base = (base == std::string::npos) ? 0 : base + 1;
+        size_t dot = m_filename.rfind('.');
+        if (dot == std::string::npos || dot <= base)
+        {
+            dot = m_filename.size();
+        }
+        std::string directory = m_filename.substr(0, base);
+        std::string name = m_filename.substr(base, dot - base);
+        std::string extension = m_filename.substr(dot);
+
+        // Writes the current tile of level l, then merges its columns into level l + 1; column c of
+        // level l becomes (half of) column c/2 there, and level l + 1 moves on to its next tile as needed.
+        std::function<void(size_t)> flush = [&](size_t l)
+        {
+            write_tile(directory + name + "_" + std::to_string(l) + "_" + std::to_string(tile[l]) + extension,
+                       levels[l], tile[l], samples_per_column << l);
+            if (l < top)
+            {
+                for (size_t k = 0; k < width; ++k)
+                {
+                    size_t column = (tile[l]*width + k)/2;
+                    if (column/width != tile[l + 1])
+                    {
+                        flush(l + 1);
+                        tile[l + 1] = column/width;
+                    }
+                    for (size_t i = 0; i < m_dataset.size(); ++i)
+                    {
+                        levels[l + 1][i].merge(column % width, levels[l][i][k]);
+                    }
+                }
+            }
+            for (auto & buckets : levels[l])
+            {
+                buckets.clear();
+            }
         };
 
+        size_t samples_per_tile = width*samples_per_column;
+        for (size_t t = 0; t*samples_per_tile < samples; ++t)
+        {
+            tile[0] = t;
+            for (size_t i = 0; i < m_dataset.size(); ++i)
+            {
+                auto const & v = m_dataset[i];
+                size_t end = std::min(v.size(), (t + 1)*samples_per_tile);
+                for (size_t j = t*samples_per_tile; j < end; ++j)
+                {
+                    levels[0][i].add((j/samples_per_column) % width, j, v[j]);
+                }
+            }
+            flush(0);
+        }
+        // Every level above 0 still holds a partial (or the last) tile:
+        for (size_t l = 1; l <= top; ++l)
+        {
+            flush(l);
+        }
+
+        detail::svg_buffer index;
+        index << "{\n\"start_time\": " << detail::significant_digits<Real>{m_start_time, 17}
+              << ",\n\"time_step\": " << detail::significant_digits<Real>{m_time_step, 17}
+              << ",\n\"min_y\": " << detail::significant_digits<Real>{m_min_y, 17}
+              << ",\n\"max_y\": " << detail::significant_digits<Real>{m_max_y, 17}
+              << ",\n\"samples\": " << samples
+              << ",\n\"tile_columns\": " << width
+              << ",\n\"levels\": [\n";
+        for (size_t l = 0; l <= top; ++l)
+        {
+            size_t per_tile = samples_per_tile << l;
+            index << "  {\"level\": " << l << ", \"samples_per_column\": " << (samples_per_column << l)
+                  << ", \"samples_per_tile\": " << per_tile << ", \"tiles\": " << (samples + per_tile - 1)/per_tile
+                  << ", \"file\": \"" << name << "_" << l << "_{tile}" << extension << "\"}"
+                  << (l < top ? ",\n" : "\n");
+        }
+        index << "]\n}\n";
+        detail::svg_buffer::write_file(directory + name + ".json", index.str());
+        m_is_written = true;
+    }
+
+    ~plot_time_series()
+    {
+        if (!m_is_written)
+        {
+            std::cerr << "Warning: You did not write your data to disk!\n";
+        }
+    }
+
+private:
+    struct stream
+    {
+        size_t total;
+        size_t received;
+        // Indices of the samples inside the viewport:
+        std::pair<size_t, size_t> window;
+        // The x-range the columns were assigned on, and sample j's position x0 + j*step in it:
+        Real lo_x;
+        Real hi_x;
+        double x0;
+        double step;
+        detail::m4_columns<Real> columns;
+    };
+
+    // The x-axis: the viewport if one is set, and the span of the datasets otherwise.
+    std::pair<Real, Real> visible_time() const
+    {
+        return m_windowed ? std::make_pair(m_t0, m_t1) : std::make_pair(m_first_time, m_end_time);
+    }
+
+    // Screen position of start_time and the pixels between consecutive samples, for an x-axis spanning [lo_x, hi_x].
+    std::pair<double, double> sample_placement(Real lo_x, Real hi_x) const
+    {
+        if (!(lo_x < hi_x))
+        {
+            return {0.0, 0.0};
+        }
+        detail::axis_map<Real> x_scale(lo_x, hi_x, m_graph_width);
+        return {x_scale(m_start_time), static_cast<double>(m_time_step)*x_scale.scale()};
+    }
+
+    // The pixel column containing screen position x; the far edge belongs to the last column, and anything off
+    // the graph to the nearest column.
+    size_t column(double x) const
+    {
+        return x > 0 ? static_cast<size_t>(std::min(x, double(m_graph_width - 1))) : 0;
+    }
+
+    // The group, axes and gridlines, for x in [lo_x, hi_x] and y in [m_min_y, m_max_y].
+    void write_frame(detail::axis_map<Real> const & x_scale, detail::axis_map<Real> const & y_scale, Real lo_x, Real hi_x)
+    {
           // Construct SVG group to simplify the calculations slightly:
-        m_fs << "<g transform='translate(" << m_margin_left << ", " << m_margin_top << ")'>\n";
+        m_svg << "<g transform='translate(" << m_margin_left << ", " << m_margin_top << ")'>\n";
              // y-axis:
-        m_fs  << "<line x1='0' y1='0' x2='0' y2='" << m_graph_height
+        m_svg << "<line x1='0' y1='0' x2='0' y2='" << m_graph_height
               << "' stroke='gray' stroke-width='1' />\n";
         // x-axis: If 0 is between the min a max height, place the axis at zero.
         // Otherwise, place is at the bottom of the graph.
-        Real x_axis_loc = m_graph_height;
+        double x_axis_loc = m_graph_height;
         if (m_min_y <= 0 && m_max_y >= 0)
         {
             x_axis_loc = y_scale(0);
         }
-        m_fs << "<line x1='0' y1='" << x_axis_loc
-             << "' x2='" << m_graph_width << "' y2='" << x_axis_loc
-             << "' stroke='gray' stroke-width='1' />\n";
+        m_svg << "<line x1='0' y1='" << x_axis_loc
+              << "' x2='" << m_graph_width << "' y2='" << x_axis_loc
+              << "' stroke='gray' stroke-width='1' />\n";
 
-        detail::write_gridlines(m_fs, 8, 10, x_scale, y_scale, m_start_time, m_end_time,
+        detail::write_gridlines(m_svg, 8, 10, x_scale, y_scale, lo_x, hi_x,
                                 m_min_y, m_max_y, m_graph_width, m_graph_height, m_margin_left);
+    }
+
+    // Writes m_svg, or the canvas page for HTML output.
+    void write_file(std::string const & filename)
+    {
+        if (m_html)
+        {
+            int width = m_graph_width + m_margin_left + m_margin_right;
+            int height = m_graph_height + m_margin_top + m_margin_bottom;
+            detail::svg_buffer::write_file(filename, m_canvas.html(m_svg.str(), width, height, m_margin_left, m_margin_top));
+        }
+        else
+        {
+            m_svg.write_to(filename);
+        }
+    }
 
+    // Tile t of a level with samples_per_column samples per column; the buckets hold absolute sample indices.
+    void write_tile(std::string const & filename, std::vector<detail::m4_columns<Real>> const & buckets,
+                    size_t t, size_t samples_per_column)
+    {
+        size_t first = t*m_graph_width*samples_per_column;
+        Real lo_x = m_start_time + m_time_step*first;
+        Real hi_x = m_start_time + m_time_step*(first + m_graph_width*samples_per_column);
+        detail::axis_map<Real> x_scale(lo_x, hi_x, m_graph_width);
+        detail::axis_map<Real> y_scale(m_min_y, m_max_y, m_graph_height, true);
+        int width = m_graph_width + m_margin_left + m_margin_right;
+        int height = m_graph_height + m_margin_top + m_margin_bottom;
 
-        for (size_t i = 0; i < m_connect.size(); ++i)
+        m_svg.clear();
+        m_svg.set_sink(detail::raster_sink(filename));
+        m_canvas = detail::canvas_layers();
+        detail::write_prelude(m_svg, m_title, width, height, m_margin_top);
+        write_frame(x_scale, y_scale, lo_x, hi_x);
+        std::vector<size_t> indices;
+        std::vector<Real> values;
+        std::vector<double> ys;
+        for (size_t i = 0; i < buckets.size(); ++i)
         {
-            bool connect_the_dots = m_connect[i];
-            auto const & v = m_dataset[i];
-            std::string const & stroke = m_connect_color[i];
-            std::string const & dot_color = m_dot_color[i];
-            if(connect_the_dots)
+            indices.clear();
+            values.clear();
+            for (size_t k = 0; k < buckets[i].size(); ++k)
             {
-                m_fs << "<path d='M" << x_scale(m_start_time) << " " << y_scale(v[0]);
-                for (size_t j = 1; j < v.size(); ++j)
+                auto const & b = buckets[i][k];
+                if (b.count == 0)
                 {
-                    Real t = x_scale(m_start_time + j*m_time_step);
-                    m_fs << " L" << t << " " << y_scale(v[j]);
+                    continue;
+                }
+                // The retained samples of the column, in index order:
+                typename detail::m4_columns<Real>::sample s[4] = {b.first, b.min, b.max, b.last};
+                std::sort(s, s + 4, [](auto const & x, auto const & y) { return x.index < y.index; });
+                for (int m = 0; m < 4; ++m)
+                {
+                    if (m == 0 || s[m].index != s[m-1].index)
+                    {
+                        indices.push_back(s[m].index);
+                        values.push_back(s[m].value);
+                    }
                 }
-                m_fs << "' stroke='" << stroke << "' stroke-width='1' fill='none'></path>\n";
             }
+            ys.resize(values.size());
+            y_scale.transform(values.data(), values.size(), 1, ys.data());
+            double step = 1.0/samples_per_column;
+            write_dataset(indices.size(), [&](size_t k) { return (indices[k] - first)*step; },
+                          [&](size_t k) { return ys[k]; }, [](size_t) { return true; }, 0,
+                          m_connect[i], m_connect_color[i], m_dot_color[i]);
+        }
+        m_svg << "</g>\n"
+              << "</svg>\n";
+        write_file(filename);
+    }
 
-            for (size_t j = 0; j < v.size(); ++j)
+    // Draws n samples at (x(k), y(k)); the line from sample k-1 to k is drawn if joined(k).
+    // If dx > 0, x(k) = x(0) + k*dx, and HTML output stores only the y-coordinates. An empty dot_color draws no dots.
+    template<class X, class Y, class J>
+    void write_dataset(size_t n, X x, Y y, J joined, double dx, bool connect_the_dots,
+                       std::string const & stroke, std::string const & dot_color)
+    {
+        if (n == 0)
+        {
+            return;
+        }
+        if (m_html)
+        {
+            // A NaN between two samples breaks the line:
+            std::vector<double> xs;
+            std::vector<double> ys;
+            for (size_t k = 0; k < n; ++k)
+            {
+                if (k > 0 && !joined(k))
+                {
+                    xs.push_back(std::numeric_limits<double>::quiet_NaN());
+                    ys.push_back(std::numeric_limits<double>::quiet_NaN());
+                }
+                if (dx <= 0)
+                {
+                    xs.push_back(x(k));
+                }
+                ys.push_back(y(k));
+            }
+            size_t y_array = m_canvas.add_array(ys.data(), ys.size());
+            size_t x_array = dx > 0 ? 0 : m_canvas.add_array(xs.data(), xs.size());
+            auto layer = [&](std::string const & color, double width, bool line)
+            {
+                if (dx > 0)
+                {
+                    m_canvas.add_series(y_array, x(0), dx, color, width, line);
+                }
+                else
+                {
+                    m_canvas.add_points(x_array, y_array, color, width, line);
+                }
+            };
+            if (connect_the_dots)
+            {
+                layer(stroke, 1, true);
+            }
+            if (!dot_color.empty())
             {
-                Real t = x_scale(m_start_time + j*m_time_step);
-                m_fs << "<circle cx='" << t << "' cy='" << y_scale(v[j])
-                     << "' r='1' fill='" << dot_color << "' />\n";
+                layer(dot_color, 1, false);
             }
+            return;
+        }
+        if (connect_the_dots)
+        {
+            detail::path_writer path(m_svg, m_compact_paths, stroke, 1);
+            path.move_to(x(0), y(0));
+            for (size_t k = 1; k < n; ++k)
+            {
+                if (joined(k))
+                {
+                    path.line_to(x(k), y(k));
+                }
+                else
+                {
+                    path.move_to(x(k), y(k));
+                }
+            }
+            path.close();
         }
 
-        m_fs << "</g>\n"
-           << "</svg>\n";
-        m_fs.close();
-
-        m_is_written = true;
+        if (dot_color.empty())
+        {
+            return;
+        }
+        detail::path_writer dots(m_svg, m_compact_paths, dot_color, 2, "stroke-linecap='round'");
+        for (size_t k = 0; k < n; ++k)
+        {
+            double t = x(k);
+            if (m_packed_markers)
+            {
+                dots.dot(t, y(k));
+                continue;
+            }
+            m_svg << "<circle cx='" << t << "' cy='" << y(k)
+                  << "' r='1' fill='" << dot_color << "' />\n";
+        }
+        dots.close();
+    }
 
+    void extend_time(Real first, Real last)
+    {
+        m_first_time = std::min(m_first_time, first);
+        m_end_time = std::max(m_end_time, last);
     }
 
-    ~plot_time_series()
+    // Indices [begin, end) of the samples of an n sample dataset inside the viewport:
+    // by binary search over the timestamps if there are any, and by index arithmetic otherwise.
+    std::pair<size_t, size_t> window(size_t n, strided_span<Real> const & times) const
     {
-        if (!m_is_written)
+        if (!m_windowed)
         {
-            std::cerr << "Warning: You did not write your data to disk!\n";
+            return {0, n};
+        }
+        if (times.size() > 0)
+        {
+            // First index in [0, n) for which pred is false; pred must be true then false along the timestamps.
+            auto partition_point = [&](auto pred)
+            {
+                size_t lo = 0;
+                size_t hi = n;
+                while (lo < hi)
+                {
+                    size_t mid = lo + (hi - lo)/2;
+                    if (pred(times[mid]))
+                    {
+                        lo = mid + 1;
+                    }
+                    else
+                    {
+                        hi = mid;
+                    }
+                }
+                return lo;
+            };
+            size_t begin = partition_point([&](Real const & t) { return t < m_t0; });
+            size_t end = partition_point([&](Real const & t) { return !(m_t1 < t); });
+            return {begin, end};
         }
+        using std::ceil;
+        using std::floor;
+        double first = static_cast<double>(ceil((m_t0 - m_start_time)/m_time_step));
+        double last = static_cast<double>(floor((m_t1 - m_start_time)/m_time_step));
+        size_t begin = first <= 0 ? 0 : (first >= n ? n : static_cast<size_t>(first));
+        size_t end = last < 0 ? 0 : (last >= n ? n : static_cast<size_t>(last) + 1);
+        return {begin, std::max(begin, end)};
     }
 
-private:
-    std::ofstream m_fs;
+    detail::svg_buffer m_svg;
+    std::string m_title;
+    std::string m_filename;
     Real m_start_time;
+    // Time span of all datasets:
+    Real m_first_time;
     Real m_end_time;
     Real m_time_step;
     Real m_min_y;
     Real m_max_y;
     bool m_is_written;
+    bool m_decimate;
+    bool m_compact_paths;
+    bool m_packed_markers;
+    // Datasets go to m_canvas rather than into the SVG:
+    bool m_html;
+    detail::canvas_layers m_canvas;
+    bool m_windowed;
+    Real m_t0;
+    Real m_t1;
+    Real m_max_gap;
     std::vector<bool> m_connect;
-    // Should be a list:
-    std::vector<std::vector<Real>> m_dataset;
+    // Views of either caller memory or of m_owned; a list so the owned buffers never move:
+    std::list<std::vector<Real>> m_owned;
+    std::vector<strided_span<Real>> m_dataset;
+    // Timestamps of each dataset; empty for evenly spaced ones:
+    std::vector<strided_span<Real>> m_times;
+    // Index into m_streams of each dataset, or -1 if it is held in m_dataset:
+    std::vector<long> m_stream_of;
+    std::vector<stream> m_streams;
     std::vector<std::string> m_connect_color;
     std::vector<std::string> m_dot_color;
     int m_margin_top;
@@ -3,12 +3,21 @@
 
 #include <cassert>
 #include <vector>
+#include <list>
 #include <string>
 #include <utility>
 #include <fstream>
 #include <algorithm>
 #include <iostream>
+#include <array>
+#include <cmath>
+#include <cstdint>
 #include <quicksvg/detail/generic_svg_functionality.hpp>
+#include <quicksvg/detail/canvas.hpp>
+#include <quicksvg/detail/parallel_for.hpp>
+#include <quicksvg/detail/png.hpp>
+#include <quicksvg/detail/raster.hpp>
+#include <quicksvg/strided_span.hpp>
 
 namespace quicksvg {
 
@@ -25,10 +34,16 @@ public:
                     m_max_x{std::numeric_limits<Real>::lowest()},
                     m_min_y{std::numeric_limits<Real>::max()},
                     m_max_y{std::numeric_limits<Real>::lowest()},
-                    m_is_written{false}
+                    m_is_written{false},
+                    m_compact_paths{false},
+                    m_packed_markers{false},
+                    m_html{detail::is_html(filename)},
+                    m_density_cell{0},
+                    m_density_png{false},
+                    m_threads{1}
 
     {
-        m_fs.open(filename);
+        m_filename = filename;
 
         m_margin_top = 40;
         if (title == "") {
@@ -48,52 +63,113 @@ public:
         m_graph_height = height - m_margin_bottom - m_margin_top;
         m_graph_width = width - m_margin_left - m_margin_right;
 
-        detail::write_prelude(m_fs, title, width, height, m_margin_top);
+        m_svg.set_sink(detail::raster_sink(filename));
+        detail::write_prelude(m_svg, title, width, height, m_margin_top);
 
         if (x_label != "") {
-            detail::write_xlabel(m_fs, x_label, width, height, m_margin_bottom);
+            detail::write_xlabel(m_svg, x_label, width, height, m_margin_bottom);
         }
 
         if (y_label != "") {
-            detail::write_ylabel(m_fs, y_label, width, height, m_margin_left);
+            detail::write_ylabel(m_svg, y_label, width, height, m_margin_left);
         }
 
     }
 
+    // Number of decimals printed for coordinates; 3 by default.
+    void set_precision(int decimals)
+    {
+        m_svg.set_precision(decimals);
+    }
+
+    // Writes paths in the compact encoding of detail::path_writer.
+    void set_compact_paths(bool compact)
+    {
+        m_compact_paths = compact;
+    }
+
+    // Draw all dots of a dataset as one <path> of round-capped zero-length segments instead of a <circle> per point.
+    void set_packed_markers(bool packed)
+    {
+        m_packed_markers = packed;
+    }
+
+    // Count the points in square cells of cell_pixels pixels and draw the counts as a heatmap (log color scale)
+    // instead of a marker per point, so the output size depends on the canvas rather than the number of points.
+    // The heatmap is written as one <rect> per run of equally colored cells, or as an embedded PNG
+    // (bitmap output always draws the cells).
+    // cell_pixels = 0 turns it off.
+    void set_density(int cell_pixels, bool png = false)
+    {
+        if (cell_pixels < 0)
+        {
+            throw std::domain_error("The density cell size must be nonnegative; requested " + std::to_string(cell_pixels));
+        }
+        m_density_cell = cell_pixels;
+        m_density_png = png;
+    }
+
+    // Threads used to bin the points in density mode (0 = all cores).
+    void set_threads(unsigned threads)
+    {
+        m_threads = threads;
+    }
+
     void add_dataset(std::vector<std::pair<Real, Real>> const & v, bool connect_the_dots = false,
                      std::string dot_color = "steelblue", std::string connect_color="orange")
+    {
+        std::vector<Real> xs(v.size());
+        std::vector<Real> ys(v.size());
+        for (size_t i = 0; i < v.size(); ++i)
+        {
+            xs[i] = v[i].first;
+            ys[i] = v[i].second;
+        }
+        add_dataset(std::move(xs), std::move(ys), connect_the_dots, dot_color, connect_color);
+    }
+
+    void add_dataset(std::vector<Real> const & xs, std::vector<Real> const & ys, bool connect_the_dots = false,
+                     std::string dot_color = "steelblue", std::string connect_color="orange")
+    {
+        add_dataset(std::vector<Real>(xs), std::vector<Real>(ys), connect_the_dots, dot_color, connect_color);
+    }
+
+    // Takes ownership of the columns without copying them.
+    void add_dataset(std::vector<Real> && xs, std::vector<Real> && ys, bool connect_the_dots = false,
+                     std::string dot_color = "steelblue", std::string connect_color="orange")
     {
         if (m_is_written)
         {
             throw std::logic_error("Cannot add data to graph after writing it.\n");
         }
+        m_owned.push_back(std::move(xs));
+        strided_span<Real> x(m_owned.back());
+        m_owned.push_back(std::move(ys));
+        strided_span<Real> y(m_owned.back());
+        add_dataset(x, y, connect_the_dots, dot_color, connect_color);
+    }
 
-        for (auto p : v)
+    // Borrows the columns; they must stay alive and unchanged until write_all returns.
+    void add_dataset(strided_span<Real> xs, strided_span<Real> ys, bool connect_the_dots = false,
+                     std::string dot_color = "steelblue", std::string connect_color="orange")
+    {
+        if (m_is_written)
         {
-            if (p.first < m_min_x)
-            {
-                m_min_x = p.first;
-            }
-            if (p.first > m_max_x)
-            {
-                m_max_x = p.first;
-            }
-
-            if (p.second < m_min_y)
-            {
-                 m_min_y = p.second;
-            }
-            if (p.second > m_max_y)
-            {
-                m_max_y = p.second;
-            }
+            throw std::logic_error("Cannot add data to graph after writing it.\n");
+        }
+        if (xs.size() != ys.size())
+        {
+            throw std::domain_error("There are " + std::to_string(xs.size()) + " abscissas but " + std::to_string(ys.size()) + " ordinates.");
         }
 
+        detail::minmax(xs.data(), xs.size(), xs.stride(), m_min_x, m_max_x);
+        detail::minmax(ys.data(), ys.size(), ys.stride(), m_min_y, m_max_y);
+
         m_connect.push_back(connect_the_dots);
         m_connect_color.push_back(connect_color);
         m_dot_color.push_back(dot_color);
-        m_dataset.push_back(v);
-
+        m_xs.push_back(xs);
+        m_ys.push_back(ys);
     }
 
     void write_all()
@@ -103,64 +179,95 @@ public:
             throw std::logic_error("Data is already written to the svg.\n");
         }
         // Maps [a,b] to [0, graph_width]
-        auto x_scale = [this](Real x)->Real
-        {
-            return ((x-m_min_x)/(m_max_x- m_min_x))*static_cast<Real>(m_graph_width);
-        };
-
-        auto y_scale = [this](Real y)-> Real
-        {
-          return ((m_max_y - y)/(m_max_y - m_min_y) )*static_cast<Real>(m_graph_height);
-        };
+        detail::axis_map<Real> x_scale(m_min_x, m_max_x, m_graph_width);
+        detail::axis_map<Real> y_scale(m_min_y, m_max_y, m_graph_height, true);
 
           // Construct SVG group to simplify the calculations slightly:
-        m_fs << "<g transform='translate(" << m_margin_left << ", " << m_margin_top << ")'>\n";
+        m_svg << "<g transform='translate(" << m_margin_left << ", " << m_margin_top << ")'>\n";
              // y-axis:
-        m_fs  << "<line x1='0' y1='0' x2='0' y2='" << m_graph_height
+        m_svg << "<line x1='0' y1='0' x2='0' y2='" << m_graph_height
               << "' stroke='gray' stroke-width='1' />\n";
         // x-axis: If 0 is between the min a max height, place the axis at zero.
         // Otherwise, place is at the bottom of the graph.
-        Real x_axis_loc = m_graph_height;
+        double x_axis_loc = m_graph_height;
         if (m_min_y <= 0 && m_max_y >= 0)
         {
             x_axis_loc = y_scale(0);
         }
-        m_fs << "<line x1='0' y1='" << x_axis_loc
-             << "' x2='" << m_graph_width << "' y2='" << x_axis_loc
-             << "' stroke='gray' stroke-width='1' />\n";
+        m_svg << "<line x1='0' y1='" << x_axis_loc
+              << "' x2='" << m_graph_width << "' y2='" << x_axis_loc
+              << "' stroke='gray' stroke-width='1' />\n";
 
-        detail::write_gridlines(m_fs, 8, 10, x_scale, y_scale, m_min_x, m_max_x,
+        detail::write_gridlines(m_svg, 8, 10, x_scale, y_scale, m_min_x, m_max_x,
                                 m_min_y, m_max_y, m_graph_width, m_graph_height, m_margin_left);
 
 
-        for (size_t i = 0; i < m_connect.size(); ++i)
+        if (m_density_cell > 0)
+        {
+            write_density(x_scale, y_scale);
+        }
+
+        // Screen coordinates of the current dataset:
+        std::vector<double> xs;
+        std::vector<double> ys;
+        for (size_t i = 0; i < m_connect.size() && m_density_cell == 0; ++i)
         {
             bool connect_the_dots = m_connect[i];
-            auto const & v = m_dataset[i];
+            size_t n = m_xs[i].size();
+            xs.resize(n);
+            ys.resize(n);
+            x_scale.transform(m_xs[i].data(), n, m_xs[i].stride(), xs.data());
+            y_scale.transform(m_ys[i].data(), n, m_ys[i].stride(), ys.data());
             std::string const & stroke = m_connect_color[i];
             std::string const & dot_color = m_dot_color[i];
+            if (m_html)
+            {
+                size_t x_array = m_canvas.add_array(xs.data(), n);
+                size_t y_array = m_canvas.add_array(ys.data(), n);
+                if (connect_the_dots)
+                {
+                    m_canvas.add_points(x_array, y_array, stroke, 3, true);
+                }
+                m_canvas.add_points(x_array, y_array, dot_color, 1, false);
+                continue;
+            }
             if(connect_the_dots)
             {
-                m_fs << "<path d='M" << x_scale(v[0].first) << " " << y_scale(v[0].second);
-                for (size_t j = 1; j < v.size(); ++j)
+                detail::path_writer path(m_svg, m_compact_paths, stroke, 3);
+                path.move_to(xs[0], ys[0]);
+                for (size_t j = 1; j < n; ++j)
                 {
-                    Real t = x_scale(v[j].first);
-                    m_fs << " L" << t << " " << y_scale(v[j].second);
+                    path.line_to(xs[j], ys[j]);
                 }
-                m_fs << "' stroke='" << stroke << "' stroke-width='3' fill='none'></path>\n";
+                path.close();
             }
 
-            for (size_t j = 0; j < v.size(); ++j)
+            detail::path_writer dots(m_svg, m_compact_paths, dot_color, 2, "stroke-linecap='round'");
+            for (size_t j = 0; j < n; ++j)
             {
-                Real t = x_scale(v[j].first);
-                m_fs << "<circle cx='" << t << "' cy='" << y_scale(v[j].second)
-                     << "' r='1' fill='" << dot_color << "' />\n";
+                if (m_packed_markers)
+                {
+                    dots.dot(xs[j], ys[j]);
+                    continue;
+                }
+                m_svg << "<circle cx='" << xs[j] << "' cy='" << ys[j]
+                      << "' r='1' fill='" << dot_color << "' />\n";
             }
+            dots.close();
         }
 
-        m_fs << "</g>\n"
-           << "</svg>\n";
-        m_fs.close();
+        m_svg << "</g>\n"
+            << "</svg>\n";
+        if (m_html)
+        {
+            int width = m_graph_width + m_margin_left + m_margin_right;
+            int height = m_graph_height + m_margin_top + m_margin_bottom;
+            detail::svg_buffer::write_file(m_filename, m_canvas.html(m_svg.str(), width, height, m_margin_left, m_margin_top));
+        }
+        else
+        {
+            m_svg.write_to(m_filename);
+        }
 
         m_is_written = true;
 
@@ -175,15 +282,171 @@ public:
     }
 
 private:
-    std::ofstream m_fs;
+    // The 2D histogram of all datasets, one row of cells after another.
+    // Each chunk of points is binned into its own histogram; they're summed afterwards.
+    std::vector<std::uint32_t> histogram(detail::axis_map<Real> const & x_scale, detail::axis_map<Real> const & y_scale,
+                                         size_t rows, size_t cols) const
+    {
+        std::vector<std::uint32_t> counts(rows*cols, 0);
+        // Points are transformed to screen space in blocks, so the scratch space doesn't grow with the data:
+        constexpr size_t block = 4096;
+        for (size_t i = 0; i < m_xs.size(); ++i)
+        {
+            auto const & x = m_xs[i];
+            auto const & y = m_ys[i];
+            std::vector<std::vector<std::uint32_t>> partial(detail::chunk_count(x.size(), m_threads));
+            detail::parallel_for(x.size(), m_threads, [&](size_t chunk, size_t begin, size_t end)
+            {
+                auto & h = partial[chunk];
+                h.assign(rows*cols, 0);
+                double xs[block];
+                double ys[block];
+                for (size_t j = begin; j < end; j += block)
+                {
+                    size_t n = std::min(block, end - j);
+                    x_scale.transform(x.data() + j*x.stride(), n, x.stride(), xs);
+                    y_scale.transform(y.data() + j*y.stride(), n, y.stride(), ys);
+                    for (size_t k = 0; k < n; ++k)
+                    {
+                        // NaNs fail these comparisons too:
+                        if (!(xs[k] >= 0 && xs[k] <= m_graph_width && ys[k] >= 0 && ys[k] <= m_graph_height))
+                        {
+                            continue;
+                        }
+                        size_t col = std::min(static_cast<size_t>(xs[k])/m_density_cell, cols - 1);
+                        size_t row = std::min(static_cast<size_t>(ys[k])/m_density_cell, rows - 1);
+                        ++h[row*cols + col];
+                    }
+                }
+            });
+            for (auto const & h : partial)
+            {
+                for (size_t j = 0; j < h.size(); ++j)
+                {
+                    counts[j] += h[j];
+                }
+            }
+        }
+        return counts;
+    }
+
+    // Viridis, sampled at five points and interpolated linearly; t in [0, 1].
+    static std::array<int, 3> heat_color(double t)
+    {
+        static int const anchors[5][3] = {{68, 1, 84}, {59, 82, 139}, {33, 145, 140}, {94, 201, 98}, {253, 231, 37}};
+        double u = std::min(std::max(t, 0.0), 1.0)*4;
+        int k = std::min(static_cast<int>(u), 3);
+        double f = u - k;
+        std::array<int, 3> rgb;
+        for (int c = 0; c < 3; ++c)
+        {
+            rgb[c] = static_cast<int>(std::lround(anchors[k][c] + f*(anchors[k+1][c] - anchors[k][c])));
+        }
+        return rgb;
+    }
+
+    void write_density(detail::axis_map<Real> const & x_scale, detail::axis_map<Real> const & y_scale)
+    {
+        size_t cell = m_density_cell;
+        size_t cols = (m_graph_width + cell - 1)/cell;
+        size_t rows = (m_graph_height + cell - 1)/cell;
+        std::vector<std::uint32_t> counts = histogram(x_scale, y_scale, rows, cols);
+        std::uint32_t max_count = *std::max_element(counts.begin(), counts.end());
+        if (max_count == 0)
+        {
+            return;
+        }
+        // Counts are shown on a log scale, quantized so that neighboring cells merge into runs:
+        constexpr int levels = 32;
+        auto level = [&](std::uint32_t c)->int
+        {
+            if (c == 0)
+            {
+                return -1;
+            }
+            double t = max_count > 1 ? std::log(double(c))/std::log(double(max_count)) : 1.0;
+            return static_cast<int>(std::lround(t*(levels - 1)));
+        };
+
+        // The rasterizer doesn't decode images, but draws the cells just as well as <rect>s:
+        if (m_density_png && !m_svg.has_sink())
+        {
+            std::vector<unsigned char> pixels(rows*cols*4, 0);
+            for (size_t j = 0; j < counts.size(); ++j)
+            {
+                int l = level(counts[j]);
+                if (l < 0)
+                {
+                    continue;
+                }
+                auto rgb = heat_color(double(l)/(levels - 1));
+                for (int c = 0; c < 3; ++c)
+                {
+                    pixels[4*j + c] = static_cast<unsigned char>(rgb[c]);
+                }
+                pixels[4*j + 3] = 255;
+            }
+            m_svg << "<image x='0' y='0' width='" << cols*cell << "' height='" << rows*cell
+                  << "' preserveAspectRatio='none' style='image-rendering:pixelated' href='data:image/png;base64,"
+                  << detail::base64(detail::encode_png(cols, rows, 4, pixels)) << "'/>\n";
+        }
+        else
+        {
+            m_svg << "<g shape-rendering='crispEdges'>\n";
+            for (size_t r = 0; r < rows; ++r)
+            {
+                size_t j = 0;
+                while (j < cols)
+                {
+                    int l = level(counts[r*cols + j]);
+                    size_t run = 1;
+                    while (j + run < cols && level(counts[r*cols + j + run]) == l)
+                    {
+                        ++run;
+                    }
+                    if (l >= 0)
+                    {
+                        auto rgb = heat_color(double(l)/(levels - 1));
+                        m_svg << "<rect x='" << j*cell << "' y='" << r*cell << "' width='" << run*cell << "' height='" << cell
+                              << "' fill='rgb(" << rgb[0] << "," << rgb[1] << "," << rgb[2] << ")'/>\n";
+                    }
+                    j += run;
+                }
+            }
+            m_svg << "</g>\n";
+        }
+
+        // Color scale in the right margin, with the largest count on top:
+        m_svg << "<g shape-rendering='crispEdges'>\n";
+        for (int l = 0; l < levels; ++l)
+        {
+            auto rgb = heat_color(double(l)/(levels - 1));
+            m_svg << "<rect x='" << m_graph_width + 6 << "' y='" << (m_graph_height*(levels - 1 - l))/double(levels)
+                  << "' width='8' height='" << m_graph_height/double(levels)
+                  << "' fill='rgb(" << rgb[0] << "," << rgb[1] << "," << rgb[2] << ")'/>\n";
+        }
+        m_svg << "</g>\n"
+              << "<text x='" << m_graph_width + 14 << "' y='-3' font-family='times' font-size='10' fill='white' text-anchor='end'>"
+              << max_count << "</text>\n";
+    }
+
+    detail::svg_buffer m_svg;
+    std::string m_filename;
     Real m_min_x;
     Real m_max_x;
     Real m_min_y;
     Real m_max_y;
     bool m_is_written;
+    bool m_compact_paths;
+    bool m_packed_markers;
+    // Datasets go to m_canvas rather than into the SVG:
+    bool m_html;
+    detail::canvas_layers m_canvas;
     std::vector<bool> m_connect;
-    // Should be a list:
-    std::vector<std::vector<std::pair<Real, Real>>> m_dataset;
+    // Views of either caller memory or of m_owned; a list so the owned columns never move:
+    std::list<std::vector<Real>> m_owned;
+    std::vector<strided_span<Real>> m_xs;
+    std::vector<strided_span<Real>> m_ys;
     std::vector<std::string> m_connect_color;
     std::vector<std::string> m_dot_color;
     int m_margin_top;
@@ -192,6 +455,9 @@ private:
     int m_margin_right;
     int m_graph_width;
     int m_graph_height;
+    int m_density_cell;
+    bool m_density_png;
+    unsigned m_threads;
 };
 
 } // namespace
@@ -0,0 +1,50 @@
+#ifndef QUICKSVG_STRIDED_SPAN_HPP
+#define QUICKSVG_STRIDED_SPAN_HPP
+
+#include <cstddef>
+#include <vector>
+
+namespace quicksvg {
+
+// A non-owning view of size elements spaced stride elements apart,
+// e.g. one column of an interleaved buffer. The caller keeps the memory alive.
+template<class Real>
+class strided_span
+{
+public:
+    strided_span(Real const * data, size_t size, size_t stride = 1) :
+        m_data{data},
+        m_size{size},
+        m_stride{stride}
+    {}
+
+    explicit strided_span(std::vector<Real> const & v) : strided_span(v.data(), v.size()) {}
+
+    Real const & operator[](size_t i) const
+    {
+        return m_data[i*m_stride];
+    }
+
+    size_t size() const
+    {
+        return m_size;
+    }
+
+    size_t stride() const
+    {
+        return m_stride;
+    }
+
+    Real const * data() const
+    {
+        return m_data;
+    }
+
+private:
+    Real const * m_data;
+    size_t m_size;
+    size_t m_stride;
+};
+
+} // namespace
+#endif
@@ -1,15 +1,26 @@
 #ifndef QUICKSVG_ULP_PLOT_HPP
 #define QUICKSVG_ULP_PLOT_HPP
 #include "detail/generic_svg_functionality.hpp"
+#include "detail/canvas.hpp"
+#include "detail/parallel_for.hpp"
+#include "detail/binary_io.hpp"
+#include "detail/pixel_set.hpp"
+#include "detail/raster.hpp"
 #include <algorithm>
 #include <iomanip>
 #include <cassert>
 #include <vector>
 #include <utility>
 #include <fstream>
+#include <sstream>
 #include <string>
 #include <list>
 #include <random>
+#include <type_traits>
+#include <typeinfo>
+#include <optional>
+#include <functional>
+#include <cstring>
 #if defined __has_include
 #  if __has_include (<boost/math/tools/condition_numbers.hpp>)
 #    include <boost/math/tools/condition_numbers.hpp>
@@ -25,86 +36,100 @@
 
 // The envelope is the condition number of function evaluation.
 
+// Pass threads != 1 to the constructor to evaluate the reference function on a pool of workers (0 = all cores).
+// hi_acc_impl must then be safe to call concurrently, and in the exhaustive mode so must the functions passed to add_fn;
+// the result is identical to the serial evaluation.
+
 namespace quicksvg {
 
+// Opt-in on-disk cache of the reference data (abscissas, precise ordinates and envelope).
+// The file is reused when it was written for the same function_id, [a,b], seed, sample count and types;
+// otherwise the data is recomputed and the file is overwritten. Requires a fixed random seed.
+struct ulp_cache
+{
+    std::string filename;
+    std::string function_id;
+};
+
+// Tag selecting the exhaustive constructor of ulp_plot, which compares every float in [a,b]
+// and keeps only per-column (min, max, count) buckets, so memory is O(columns) rather than O(samples).
+struct exhaustive_t
+{
+    explicit exhaustive_t() = default;
+};
+
+inline constexpr exhaustive_t exhaustive{};
+
 template<class F, typename PreciseReal, typename CoarseReal>
 class ulp_plot {
 public:
     ulp_plot(F hi_acc_impl, CoarseReal a, CoarseReal b,
-             bool perturb_abscissas = true, size_t samples = 10000, int random_seed = -1)
+             bool perturb_abscissas = true, size_t samples = 10000, int random_seed = -1, unsigned threads = 1,
+             ulp_cache const & cache = ulp_cache())
     {
-        static_assert(sizeof(PreciseReal) >= sizeof(CoarseReal), "PreciseReal must have larger size than CoarseReal");
-        if (samples < 10)
+        check_samples(samples);
+        init(a, b);
+        std::string key = cache_key(cache, perturb_abscissas, samples, random_seed, "condition number");
+        if (read_cache(cache.filename, key, samples))
         {
-            throw std::domain_error("Must have at least 10 samples, samples = " + std::to_string(samples));
+            return;
         }
-        if (b <= a)
+        generate_abscissas(perturb_abscissas, samples, random_seed);
+        evaluate_reference(hi_acc_impl, threads, [&](size_t i)->PreciseReal
         {
-            throw std::domain_error("On interval [a,b], b > a is required.");
-        }
-        a_ = a;
-        b_ = b;
+            return boost::math::tools::evaluation_condition_number(hi_acc_impl, precise_abscissas_[i]);
+        });
+        write_cache(cache.filename, key);
+    }
 
-        std::mt19937_64 gen;
-        if (random_seed == -1)
+    // Computes the envelope |xf'(x)/f(x)| from the derivative of the reference function,
+    // rather than by finite differences, which cost several more evaluations of hi_acc_impl per sample.
+    template<class G, typename = std::enable_if_t<std::is_invocable_v<G, PreciseReal>>>
+    ulp_plot(F hi_acc_impl, G hi_acc_derivative, CoarseReal a, CoarseReal b,
+             bool perturb_abscissas = true, size_t samples = 10000, int random_seed = -1, unsigned threads = 1,
+             ulp_cache const & cache = ulp_cache())
+    {
+        check_samples(samples);
+        init(a, b);
+        std::string key = cache_key(cache, perturb_abscissas, samples, random_seed, "derivative");
+        if (read_cache(cache.filename, key, samples))
         {
-            std::random_device rd;
-            gen.seed(rd());
+            return;
         }
-        // Boost's uniform_real_distribution can generate quad and multiprecision random numbers; std's cannot:
-        boost::random::uniform_real_distribution<PreciseReal> dis(a, b);
-        precise_abscissas_.resize(samples);
-        coarse_abscissas_.resize(samples);
-
-        if (perturb_abscissas)
+        generate_abscissas(perturb_abscissas, samples, random_seed);
+        evaluate_reference(hi_acc_impl, threads, [&](size_t i)->PreciseReal
         {
-            for(size_t i = 0; i < samples; ++i)
-            {
-                precise_abscissas_[i] = dis(gen);
-            }
-            std::sort(precise_abscissas_.begin(), precise_abscissas_.end());
-            for (size_t i = 0; i < samples; ++i)
-            {
-                coarse_abscissas_[i] = static_cast<CoarseReal>(precise_abscissas_[i]);
-            }
-        }
-        else
-        {
-            for(size_t i = 0; i < samples; ++i)
-            {
-                coarse_abscissas_[i] = static_cast<CoarseReal>(dis(gen));
-            }
-            std::sort(coarse_abscissas_.begin(), coarse_abscissas_.end());
-            for (size_t i = 0; i < samples; ++i)
-            {
-                precise_abscissas_[i] = coarse_abscissas_[i];
-            }
-        }
+            using std::abs;
+            PreciseReal x = precise_abscissas_[i];
+            return abs(x*hi_acc_derivative(x)/precise_ordinates_[i]);
+        });
+        write_cache(cache.filename, key);
+    }
 
-        precise_ordinates_.resize(samples);
-        for (size_t i = 0; i < samples; ++i)
+    // Exhaustive sweep; only available for CoarseReal = float.
+    // The functions passed to add_fn are kept and compared at write, in a single walk over every float in [a,b]
+    // that evaluates hi_acc_impl once per float for all of them. The envelope, if it's drawn, is computed by finite
+    // differences, which evaluate hi_acc_impl several more times per float; pass the derivative to avoid that.
+    // The default threads = 0 runs the sweep on all cores. columns should be at least the pixel width of the graph.
+    ulp_plot(F hi_acc_impl, CoarseReal a, CoarseReal b, exhaustive_t, unsigned threads = 0, size_t columns = 1100)
+    {
+        static_assert(std::is_same_v<CoarseReal, float>, "The exhaustive sweep is only feasible for CoarseReal = float.");
+        if (columns < 2)
         {
-            precise_ordinates_[i] = hi_acc_impl(precise_abscissas_[i]);
+            throw std::domain_error("Must have at least 2 columns, columns = " + std::to_string(columns));
         }
+        init(a, b);
+        columns_ = columns;
+        threads_ = threads;
+        hi_acc_impl_.emplace(hi_acc_impl);
+    }
 
-        cond_.resize(samples, std::numeric_limits<PreciseReal>::quiet_NaN());
-        for (size_t i = 0 ; i < samples; ++i)
-        {
-            PreciseReal y = precise_ordinates_[i];
-            if (y != 0)
-            {
-                cond_[i] = boost::math::tools::evaluation_condition_number(hi_acc_impl, precise_abscissas_[i]);
-                // Half-ULP accuracy is the correctly rounded result, so make sure the envelop doesn't go below this:
-                if (cond_[i] < 0.5)
-                {
-                    cond_[i] = 0.5;
-                }
-            }
-            // else leave it as nan.
-        }
-        clip_ = -1;
-        width_ = 1100;
-        envelope_color_ = "chartreuse";
+    // Exhaustive sweep with the envelope |xf'(x)/f(x)| computed from the derivative: one call of it per float.
+    template<class G, typename = std::enable_if_t<std::is_invocable_v<G, PreciseReal>>>
+    ulp_plot(F hi_acc_impl, G hi_acc_derivative, CoarseReal a, CoarseReal b, exhaustive_t,
+             unsigned threads = 0, size_t columns = 1100) : ulp_plot(hi_acc_impl, a, b, exhaustive, threads, columns)
+    {
+        hi_acc_derivative_ = hi_acc_derivative;
     }
 
     void set_clip(int clip)
@@ -122,19 +147,46 @@ public:
         envelope_color_ = color;
     }
 
+    // Number of decimals printed for coordinates; 3 by default.
+    void set_precision(int decimals)
+    {
+        svg_.set_precision(decimals);
+    }
+
+    // Writes paths in the compact encoding of detail::path_writer.
+    void set_compact_paths(bool compact)
+    {
+        compact_paths_ = compact;
+    }
+
+    // Draw all points of a function as one <path> of round-capped zero-length segments instead of a <circle> per point.
+    void set_packed_markers(bool packed)
+    {
+        packed_markers_ = packed;
+    }
+
+    // Draw at most one point per pixel of each function. With tens of thousands of samples most of them
+    // land on a pixel that's already drawn, so the plot looks the same at a fraction of the size.
+    void set_deduplicate(bool deduplicate)
+    {
+        deduplicate_ = deduplicate;
+    }
+
     template<class G>
     void add_fn(G g, std::string const & color = "steelblue")
     {
-        using std::abs;
+        if (columns_ > 0)
+        {
+            // Swept at write, together with every other function added by then:
+            pending_fns_.emplace_back(g);
+            colors_.emplace_back(color);
+            return;
+        }
         size_t samples = precise_abscissas_.size();
         std::vector<CoarseReal> ulps(samples);
         for (size_t i = 0; i < samples; ++i)
         {
-            PreciseReal y_hi_acc = precise_ordinates_[i];
-            PreciseReal y_lo_acc = g(coarse_abscissas_[i]);
-            PreciseReal absy = abs(y_hi_acc);
-            PreciseReal dist = nextafter(static_cast<CoarseReal>(absy), std::numeric_limits<CoarseReal>::max()) - static_cast<CoarseReal>(absy);
-            ulps[i] = static_cast<CoarseReal>((y_lo_acc - y_hi_acc)/dist);
+            ulps[i] = ulp_distance(precise_ordinates_[i], g(coarse_abscissas_[i]));
         }
         ulp_list_.emplace_back(ulps);
         colors_.emplace_back(color);
@@ -147,7 +199,7 @@ public:
         using std::abs;
         using std::floor;
         using std::isnan;
-        if (ulp_list_.size() == 0)
+        if (colors_.size() == 0)
         {
             throw std::domain_error("No functions added for comparison.");
         }
@@ -155,26 +207,39 @@ public:
         {
             throw std::domain_error("Width = " + std::to_string(width_) + ", which is too small.");
         }
+        if (columns_ > 0)
+        {
+            sweep_pending(ulp_envelope);
+        }
 
         PreciseReal worst_ulp_distance = 0;
         PreciseReal min_y = std::numeric_limits<PreciseReal>::max();
         PreciseReal max_y = std::numeric_limits<PreciseReal>::lowest();
         for (auto const & ulp_vec : ulp_list_)
         {
-            for (auto const & ulp : ulp_vec)
+            CoarseReal lo = std::numeric_limits<CoarseReal>::max();
+            CoarseReal hi = std::numeric_limits<CoarseReal>::lowest();
+            detail::minmax(ulp_vec.data(), ulp_vec.size(), 1, lo, hi);
+            if (lo > hi)
             {
-                if (abs(ulp) > worst_ulp_distance)
-                {
-                    worst_ulp_distance = abs(ulp);
-                }
-                if (ulp < min_y)
-                {
-                    min_y = ulp;
-                }
-                if (ulp > max_y)
+                // All NaN:
+                continue;
+            }
+            worst_ulp_distance = std::max<PreciseReal>(worst_ulp_distance, std::max(abs(lo), abs(hi)));
+            min_y = std::min<PreciseReal>(min_y, lo);
+            max_y = std::max<PreciseReal>(max_y, hi);
+        }
+        for (auto const & buckets : ulp_columns_)
+        {
+            for (auto const & bucket : buckets)
+            {
+                if (bucket.count == 0)
                 {
-                    max_y = ulp;
+                    continue;
                 }
+                worst_ulp_distance = std::max<PreciseReal>(worst_ulp_distance, std::max(abs(bucket.min), abs(bucket.max)));
+                min_y = std::min<PreciseReal>(min_y, bucket.min);
+                max_y = std::max<PreciseReal>(max_y, bucket.max);
             }
         }
 
@@ -203,40 +268,26 @@ public:
         int graph_height = height - margin_bottom - margin_top;
         int graph_width = width_ - margin_left - margin_right;
 
-        // Maps [a,b] to [0, graph_width]
-        auto x_scale = [&](CoarseReal x)->CoarseReal
+        // The ulp distances and condition numbers are small, so the y-axis never needs PreciseReal arithmetic:
+        detail::axis_map<CoarseReal> x_scale(a_, b_, graph_width);
+        detail::axis_map<double> y_map(static_cast<double>(min_y), static_cast<double>(max_y), graph_height, true);
+        auto y_scale = [&](auto y)->double
         {
-            return ((x-a_)/(b_ - a_))*static_cast<CoarseReal>(graph_width);
+            return y_map(static_cast<double>(y));
         };
 
-        auto y_scale = [&](PreciseReal y)->PreciseReal
-        {
-            return ((max_y - y)/(max_y - min_y) )*static_cast<PreciseReal>(graph_height);
-        };
-
-        std::ofstream fs;
-        fs.open(filename);
-        fs << "<?xml version=\"1.0\" encoding='UTF-8' ?>\n"
-           << "<svg xmlns='http://www.w3.org/2000/svg' width='"
-           << width_ << "' height='"
-           << height << "'>\n"
-           << "<style>svg { background-color: black; }\n"
-           << "</style>\n";
-        if (title.size() > 0)
-        {
-            fs << "<text x='" << floor(width_/2)
-               << "' y='" << floor(margin_top/2)
-               << "' font-family='Palatino' font-size='25' fill='white'  alignment-baseline='middle' text-anchor='middle'>"
-               << title
-               << "</text>\n";
-        }
+        // Reuse the buffer (and its capacity) from the previous write:
+        detail::svg_buffer & fs = svg_;
+        fs.clear();
+        fs.set_sink(detail::raster_sink(filename));
+        detail::write_prelude(fs, title, width_, height, margin_top);
 
         // Construct SVG group to simplify the calculations slightly:
         fs << "<g transform='translate(" << margin_left << ", " << margin_top << ")'>\n";
             // y-axis:
         fs  << "<line x1='0' y1='0' x2='0' y2='" << graph_height
             << "' stroke='gray' stroke-width='1'/>\n";
-        PreciseReal x_axis_loc = y_scale(static_cast<PreciseReal>(0));
+        double x_axis_loc = y_scale(0.0);
         fs << "<line x1='0' y1='" << x_axis_loc
             << "' x2='" << graph_width << "' y2='" << x_axis_loc
             << "' stroke='gray' stroke-width='1'/>\n";
@@ -254,7 +305,7 @@ public:
                 if (min_y <= ys[i] && ys[i] <= max_y)
                 {
                     PreciseReal y_cord_dataspace = ys[i];
-                    PreciseReal y = y_scale(y_cord_dataspace);
+                    double y = y_scale(y_cord_dataspace);
                     fs << "<line x1='0' y1='" << y << "' x2='" << graph_width
                        << "' y2='" << y
                        << "' stroke='gray' stroke-width='1' opacity='0.5' stroke-dasharray='4' />\n";
@@ -262,53 +313,123 @@ public:
                     fs << "<text x='" <<  -margin_left/2 << "' y='" << y - 3
                        << "' font-family='times' font-size='10' fill='white' transform='rotate(-90 "
                        << -margin_left/2 + 11 << " " << y + 5 << ")'>"
-                       <<  std::setprecision(4) << y_cord_dataspace << "</text>\n";
+                       << detail::significant_digits<PreciseReal>{y_cord_dataspace, 4} << "</text>\n";
                 }
             }
             for (int i = 1; i <= vertical_lines; ++i)
             {
                 CoarseReal x_cord_dataspace = a_ +  ((b_ - a_)*i)/vertical_lines;
-                CoarseReal x = x_scale(x_cord_dataspace);
+                double x = x_scale(x_cord_dataspace);
                 fs << "<line x1='" << x << "' y1='0' x2='" << x
                    << "' y2='" << graph_height
                    << "' stroke='gray' stroke-width='1' opacity='0.5' stroke-dasharray='4' />\n";
 
                 fs << "<text x='" <<  x - 10  << "' y='" << graph_height + 10
                    << "' font-family='times' font-size='10' fill='white'>"
-                   << std::setprecision(4) << x_cord_dataspace << "</text>\n";
+                   << detail::significant_digits<CoarseReal>{x_cord_dataspace, 4} << "</text>\n";
             }
         }
 
+        // Screen coordinates of the abscissas, shared by all functions, and of the current function's errors:
+        std::vector<double> xs(coarse_abscissas_.size());
+        std::vector<double> ys(coarse_abscissas_.size());
+        x_scale.transform(coarse_abscissas_.data(), xs.size(), 1, xs.data());
         int color_idx = 0;
+        detail::pixel_set drawn(deduplicate_ ? graph_width : 0, deduplicate_ ? graph_height : 0);
+        // For HTML output the points go to a canvas, as a NaN where a point is skipped:
+        bool html = detail::is_html(filename);
+        detail::canvas_layers canvas;
+        size_t x_array = html ? canvas.add_array(xs.data(), xs.size()) : 0;
         for (auto const & ulp : ulp_list_)
         {
             std::string color = colors_[color_idx++];
+            detail::path_writer dots(fs, compact_paths_, color, 2, "stroke-linecap='round'");
+            drawn.clear();
+            y_map.transform(ulp.data(), ulp.size(), 1, ys.data());
             for (size_t j = 0; j < ulp.size(); ++j)
             {
-                if (isnan(ulp[j]))
+                bool skip = isnan(ulp[j]) || (clip_ > 0 && abs(ulp[j]) > clip_);
+                double x = xs[j];
+                double y = ys[j];
+                skip = skip || (deduplicate_ && !drawn.insert(static_cast<double>(x), static_cast<double>(y)));
+                if (html)
                 {
+                    if (skip)
+                    {
+                        ys[j] = std::numeric_limits<double>::quiet_NaN();
+                    }
                     continue;
                 }
-                if (clip_ > 0 && abs(ulp[j]) > clip_)
+                if (skip)
                 {
                     continue;
                 }
-                CoarseReal x = x_scale(coarse_abscissas_[j]);
-                PreciseReal y = y_scale(ulp[j]);
+                if (packed_markers_)
+                {
+                    dots.dot(x, y);
+                    continue;
+                }
                 fs << "<circle cx='" << x << "' cy='" << y << "' r='1' fill='" << color << "'/>";
             }
+            dots.close();
+            if (html)
+            {
+                canvas.add_points(x_array, canvas.add_array(ys.data(), ulp.size()), color, 1, false);
+            }
+        }
+
+        for (auto const & buckets : ulp_columns_)
+        {
+            // One vertical stroke per column, from the smallest to the largest error in it:
+            detail::path_writer path(fs, compact_paths_, colors_[color_idx++], 2, "stroke-linecap='round'");
+            for (size_t j = 0; j < buckets.size(); ++j)
+            {
+                if (buckets[j].count == 0)
+                {
+                    continue;
+                }
+                CoarseReal lo = buckets[j].min;
+                CoarseReal hi = buckets[j].max;
+                if (clip_ > 0)
+                {
+                    if (lo > clip_ || hi < -clip_)
+                    {
+                        continue;
+                    }
+                    lo = std::max<CoarseReal>(lo, -clip_);
+                    hi = std::min<CoarseReal>(hi, clip_);
+                }
+                double x = x_scale(column_center(j));
+                path.move_to(x, y_scale(hi));
+                path.line_to(x, y_scale(lo));
+            }
+            path.close();
         }
 
         if (ulp_envelope)
         {
-            write_ulp_envelope(fs, x_scale, y_scale);
+            if (columns_ > 0)
+            {
+                write_column_envelope(fs, x_scale, y_scale);
+            }
+            else
+            {
+                write_ulp_envelope(fs, x_scale, y_scale);
+            }
         }
         fs << "</g>\n"
            << "</svg>\n";
-        fs.close();
+        if (html)
+        {
+            detail::svg_buffer::write_file(filename, canvas.html(fs.str(), width_, height, margin_left, margin_top));
+        }
+        else
+        {
+            fs.write_to(filename);
+        }
     }
 
-    void write_ulp_envelope(std::ofstream & fs, std::function<CoarseReal(CoarseReal)> x_scale, std::function<PreciseReal(PreciseReal)> y_scale)
+    void write_ulp_envelope(detail::svg_buffer & fs, std::function<double(CoarseReal)> x_scale, std::function<double(PreciseReal)> y_scale)
     {
         /*std::list<std::pair<size_t, size_t>> partitions;
         size_t i = 0;
@@ -339,7 +460,7 @@ public:
             }
         }*/
  
-        std::string close_path = "' stroke='"  + envelope_color_ + "' stroke-width='1' fill='none'></path>\n";
+        detail::path_writer path(fs, compact_paths_, envelope_color_, 1);
         size_t jstart = 0;
         if (clip_ > 0)
         {
@@ -358,7 +479,7 @@ new_top_path:
         {
             goto start_bottom_paths;
         }
-        fs << "<path d='M" << x_scale(coarse_abscissas_[jmin]) << " " << y_scale(cond_[jmin]);
+        path.move_to(x_scale(coarse_abscissas_[jmin]), y_scale(cond_[jmin]));
 
         for (size_t j = jmin + 1; j < coarse_abscissas_.size(); ++j)
         {
@@ -372,15 +493,15 @@ new_top_path:
                     ++j;
                 }
                 jmin = j;
-                fs << close_path;
+                path.close();
                 goto new_top_path;
             }
 
-            CoarseReal t = x_scale(coarse_abscissas_[j]);
-            PreciseReal y = y_scale(cond_[j]);
-            fs << " L" << t << " " << y;
+            double t = x_scale(coarse_abscissas_[j]);
+            double y = y_scale(cond_[j]);
+            path.line_to(t, y);
         }
-        fs << close_path;
+        path.close();
 start_bottom_paths:
         jmin = jstart;
 new_bottom_path:
@@ -388,7 +509,7 @@ new_bottom_path:
         {
             return;
         }
-        fs << "<path d='M" << x_scale(coarse_abscissas_[jmin]) << " " << y_scale(-cond_[jmin]);
+        path.move_to(x_scale(coarse_abscissas_[jmin]), y_scale(-cond_[jmin]));
 
         for (size_t j = jmin + 1; j < coarse_abscissas_.size(); ++j)
         {
@@ -402,23 +523,389 @@ new_bottom_path:
                     ++j;
                 }
                 jmin = j;
-                fs << close_path;
+                path.close();
                 goto new_bottom_path;
             }
-            CoarseReal t = x_scale(coarse_abscissas_[j]);
-            PreciseReal y = y_scale(-cond_[j]);
-            fs << " L" << t << " " << y;
+            double t = x_scale(coarse_abscissas_[j]);
+            double y = y_scale(-cond_[j]);
+            path.line_to(t, y);
         }
-        fs << close_path;
+        path.close();
     }
 
 private:
+    struct column_bucket
+    {
+        CoarseReal min = std::numeric_limits<CoarseReal>::max();
+        CoarseReal max = std::numeric_limits<CoarseReal>::lowest();
+        size_t count = 0;
+    };
+
+    static CoarseReal ulp_distance(PreciseReal y_hi_acc, PreciseReal y_lo_acc)
+    {
+        using std::abs;
+        PreciseReal absy = abs(y_hi_acc);
+        PreciseReal dist = nextafter(static_cast<CoarseReal>(absy), std::numeric_limits<CoarseReal>::max()) - static_cast<CoarseReal>(absy);
+        return static_cast<CoarseReal>((y_lo_acc - y_hi_acc)/dist);
+    }
+
+    // Maps floats to unsigned integers of the same order, so that [a,b] can be walked with a counter.
+    static std::uint32_t ordered_bits(float x)
+    {
+        std::uint32_t u;
+        std::memcpy(&u, &x, sizeof(u));
+        return (u & 0x80000000u) ? ~u : (u | 0x80000000u);
+    }
+
+    static float from_ordered_bits(std::uint32_t u)
+    {
+        u = (u & 0x80000000u) ? (u & 0x7FFFFFFFu) : ~u;
+        float x;
+        std::memcpy(&x, &u, sizeof(x));
+        return x;
+    }
+
+    size_t column(CoarseReal x) const
+    {
+        double t = (double(x) - double(a_))/(double(b_) - double(a_));
+        return std::min(static_cast<size_t>(t*columns_), columns_ - 1);
+    }
+
+    CoarseReal column_center(size_t j) const
+    {
+        return static_cast<CoarseReal>(double(a_) + (double(b_) - double(a_))*(j + 0.5)/columns_);
+    }
+
+    // Evaluates op(x, v), which fills v[0, outputs), at every float in [a_, b_] and reduces the non-NaN values
+    // of each output per column. Each chunk of the sweep reduces into its own buckets, which are merged in order afterwards.
+    template<class Op>
+    std::vector<std::vector<column_bucket>> sweep(size_t outputs, Op op) const
+    {
+        using std::isnan;
+        std::uint32_t first = ordered_bits(a_);
+        size_t n = size_t(ordered_bits(b_) - first) + 1;
+        std::vector<std::vector<column_bucket>> partial(detail::chunk_count(n, threads_));
+        detail::parallel_for(n, threads_, [&](size_t chunk, size_t begin, size_t end)
+        {
+            // Output o of column j is buckets[o*columns_ + j]:
+            auto & buckets = partial[chunk];
+            buckets.resize(outputs*columns_);
+            std::vector<CoarseReal> v(outputs);
+            for (size_t i = begin; i < end; ++i)
+            {
+                CoarseReal x = from_ordered_bits(first + static_cast<std::uint32_t>(i));
+                op(x, v.data());
+                size_t j = column(x);
+                for (size_t o = 0; o < outputs; ++o)
+                {
+                    if (isnan(v[o]))
+                    {
+                        continue;
+                    }
+                    auto & bucket = buckets[o*columns_ + j];
+                    bucket.min = std::min(bucket.min, v[o]);
+                    bucket.max = std::max(bucket.max, v[o]);
+                    ++bucket.count;
+                }
+            }
+        });
+        std::vector<std::vector<column_bucket>> buckets(outputs, std::vector<column_bucket>(columns_));
+        for (auto const & p : partial)
+        {
+            for (size_t k = 0; k < p.size(); ++k)
+            {
+                auto & bucket = buckets[k/columns_][k % columns_];
+                bucket.min = std::min(bucket.min, p[k].min);
+                bucket.max = std::max(bucket.max, p[k].max);
+                bucket.count += p[k].count;
+            }
+        }
+        return buckets;
+    }
+
+    // Compares the functions added since the last write, and computes the envelope if it's wanted and not yet known,
+    // in one sweep: hi_acc_impl is evaluated once per float for all the functions, plus the evaluations of the envelope.
+    void sweep_pending(bool envelope)
+    {
+        envelope = envelope && envelope_columns_.empty();
+        size_t k = pending_fns_.size();
+        if (k == 0 && !envelope)
+        {
+            return;
+        }
+        auto & hi_acc_impl = *hi_acc_impl_;
+        auto buckets = sweep(k + envelope, [&](CoarseReal x, CoarseReal * v)
+        {
+            PreciseReal y = hi_acc_impl(x);
+            for (size_t i = 0; i < k; ++i)
+            {
+                v[i] = ulp_distance(y, pending_fns_[i](x));
+            }
+            if (envelope)
+            {
+                v[k] = std::numeric_limits<CoarseReal>::quiet_NaN();
+                if (y != 0)
+                {
+                    using std::abs;
+                    PreciseReal cond = hi_acc_derivative_ ? PreciseReal(abs(PreciseReal(x)*hi_acc_derivative_(PreciseReal(x))/y))
+                                     : boost::math::tools::evaluation_condition_number(hi_acc_impl, PreciseReal(x));
+                    v[k] = static_cast<CoarseReal>(cond < 0.5 ? PreciseReal(0.5) : cond);
+                }
+            }
+        });
+        for (size_t i = 0; i < k; ++i)
+        {
+            ulp_columns_.emplace_back(std::move(buckets[i]));
+        }
+        if (envelope)
+        {
+            envelope_columns_ = std::move(buckets[k]);
+        }
+        pending_fns_.clear();
+    }
+
+    // The exhaustive analogue of write_ulp_envelope: +/- the largest condition number in each column.
+    template<class F1, class F2>
+    void write_column_envelope(detail::svg_buffer & fs, F1 x_scale, F2 y_scale)
+    {
+        detail::path_writer path(fs, compact_paths_, envelope_color_, 1);
+        for (CoarseReal sign : {1, -1})
+        {
+            bool open = false;
+            for (size_t j = 0; j < envelope_columns_.size(); ++j)
+            {
+                auto const & bucket = envelope_columns_[j];
+                if (bucket.count == 0 || (clip_ > 0 && bucket.max > clip_))
+                {
+                    path.close();
+                    open = false;
+                    continue;
+                }
+                double y = y_scale(sign*bucket.max);
+                if (open)
+                {
+                    path.line_to(x_scale(column_center(j)), y);
+                }
+                else
+                {
+                    path.move_to(x_scale(column_center(j)), y);
+                }
+                open = true;
+            }
+            path.close();
+        }
+    }
+
+    static void check_samples(size_t samples)
+    {
+        if (samples < 10)
+        {
+            throw std::domain_error("Must have at least 10 samples, samples = " + std::to_string(samples));
+        }
+    }
+
+    void init(CoarseReal a, CoarseReal b)
+    {
+        static_assert(sizeof(PreciseReal) >= sizeof(CoarseReal), "PreciseReal must have larger size than CoarseReal");
+        if (b <= a)
+        {
+            throw std::domain_error("On interval [a,b], b > a is required.");
+        }
+        a_ = a;
+        b_ = b;
+        clip_ = -1;
+        width_ = 1100;
+        envelope_color_ = "chartreuse";
+        columns_ = 0;
+        threads_ = 1;
+        compact_paths_ = false;
+        packed_markers_ = false;
+        deduplicate_ = false;
+    }
+
+    void generate_abscissas(bool perturb_abscissas, size_t samples, int random_seed)
+    {
+        std::mt19937_64 gen;
+        if (random_seed == -1)
+        {
+            std::random_device rd;
+            gen.seed(rd());
+        }
+        else
+        {
+            gen.seed(random_seed);
+        }
+        // Boost's uniform_real_distribution can generate quad and multiprecision random numbers; std's cannot:
+        boost::random::uniform_real_distribution<PreciseReal> dis(a_, b_);
+        precise_abscissas_.resize(samples);
+        coarse_abscissas_.resize(samples);
+
+        if (perturb_abscissas)
+        {
+            for(size_t i = 0; i < samples; ++i)
+            {
+                precise_abscissas_[i] = dis(gen);
+            }
+            std::sort(precise_abscissas_.begin(), precise_abscissas_.end());
+            for (size_t i = 0; i < samples; ++i)
+            {
+                coarse_abscissas_[i] = static_cast<CoarseReal>(precise_abscissas_[i]);
+            }
+        }
+        else
+        {
+            for(size_t i = 0; i < samples; ++i)
+            {
+                coarse_abscissas_[i] = static_cast<CoarseReal>(dis(gen));
+            }
+            std::sort(coarse_abscissas_.begin(), coarse_abscissas_.end());
+            for (size_t i = 0; i < samples; ++i)
+            {
+                precise_abscissas_[i] = coarse_abscissas_[i];
+            }
+        }
+    }
+
+    template<class Condition>
+    void evaluate_reference(F & hi_acc_impl, unsigned threads, Condition condition_number)
+    {
+        size_t samples = precise_abscissas_.size();
+        precise_ordinates_.resize(samples);
+        cond_.resize(samples, std::numeric_limits<PreciseReal>::quiet_NaN());
+        detail::parallel_for(samples, threads, [&](size_t, size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; ++i)
+            {
+                precise_ordinates_[i] = hi_acc_impl(precise_abscissas_[i]);
+                if (precise_ordinates_[i] != 0)
+                {
+                    cond_[i] = condition_number(i);
+                    // Half-ULP accuracy is the correctly rounded result, so make sure the envelop doesn't go below this:
+                    if (cond_[i] < 0.5)
+                    {
+                        cond_[i] = 0.5;
+                    }
+                }
+                // else leave it as nan.
+            }
+        });
+    }
+
+    // An empty key means caching is off.
+    std::string cache_key(ulp_cache const & cache, bool perturb_abscissas, size_t samples, int random_seed,
+                          std::string const & envelope) const
+    {
+        if (cache.filename.empty())
+        {
+            return "";
+        }
+        if (random_seed == -1)
+        {
+            throw std::domain_error("Caching the reference data requires a fixed random seed.");
+        }
+        std::ostringstream oss;
+        oss << std::setprecision(std::numeric_limits<CoarseReal>::max_digits10)
+            << cache.function_id << "\n[" << a_ << ", " << b_ << "]\nseed = " << random_seed
+            << "\nsamples = " << samples << "\nperturb = " << perturb_abscissas << "\nenvelope = " << envelope
+            << "\nPreciseReal = " << typeid(PreciseReal).name() << ", " << std::numeric_limits<PreciseReal>::digits << " bits"
+            << "\nCoarseReal = " << typeid(CoarseReal).name() << ", " << std::numeric_limits<CoarseReal>::digits << " bits\n";
+        return oss.str();
+    }
+
+    // Returns false, and the data is recomputed, unless the file holds exactly the requested samples for this key.
+    bool read_cache(std::string const & filename, std::string const & key, size_t expected_samples)
+    {
+        if (filename.empty())
+        {
+            return false;
+        }
+        std::ifstream ifs(filename, std::ios::binary);
+        std::string magic;
+        std::string stored_key;
+        std::uint64_t samples;
+        if (!ifs || !detail::read_string(ifs, magic) || magic != cache_magic()
+         || !detail::read_string(ifs, stored_key) || stored_key != key
+         || !detail::read_pod(ifs, samples) || samples != expected_samples || !ifs)
+        {
+            return false;
+        }
+        precise_abscissas_.resize(samples);
+        precise_ordinates_.resize(samples);
+        cond_.resize(samples);
+        for (auto v : {&precise_abscissas_, &precise_ordinates_, &cond_})
+        {
+            for (auto & x : *v)
+            {
+                if (!detail::read_real(ifs, x))
+                {
+                    precise_abscissas_.clear();
+                    precise_ordinates_.clear();
+                    cond_.clear();
+                    return false;
+                }
+            }
+        }
+        // Trailing bytes mean the file is not what this version wrote:
+        if (ifs.peek() != std::ifstream::traits_type::eof())
+        {
+            precise_abscissas_.clear();
+            precise_ordinates_.clear();
+            cond_.clear();
+            return false;
+        }
+        coarse_abscissas_.resize(samples);
+        for (size_t i = 0; i < samples; ++i)
+        {
+            coarse_abscissas_[i] = static_cast<CoarseReal>(precise_abscissas_[i]);
+        }
+        return true;
+    }
+
+    void write_cache(std::string const & filename, std::string const & key) const
+    {
+        if (filename.empty())
+        {
+            return;
+        }
+        // Serialized first, so the file is written in one go by write_file:
+        std::ostringstream oss(std::ios::binary);
+        detail::write_string(oss, cache_magic());
+        detail::write_string(oss, key);
+        detail::write_pod(oss, static_cast<std::uint64_t>(precise_abscissas_.size()));
+        for (auto v : {&precise_abscissas_, &precise_ordinates_, &cond_})
+        {
+            for (auto const & x : *v)
+            {
+                detail::write_real(oss, x);
+            }
+        }
+        detail::svg_buffer::write_file(filename, oss.str());
+    }
+
+    static std::string cache_magic()
+    {
+        return "quicksvg ulp_plot cache v1";
+    }
+
     std::vector<PreciseReal> precise_abscissas_;
     std::vector<CoarseReal> coarse_abscissas_;
     std::vector<PreciseReal> precise_ordinates_;
     std::vector<PreciseReal> cond_;
     std::list<std::vector<CoarseReal>> ulp_list_;
+    // Exhaustive mode only; columns_ == 0 otherwise.
+    size_t columns_;
+    unsigned threads_;
+    std::optional<F> hi_acc_impl_;
+    // Empty if the envelope is computed by finite differences:
+    std::function<PreciseReal(PreciseReal)> hi_acc_derivative_;
+    std::vector<std::function<CoarseReal(CoarseReal)>> pending_fns_;
+    std::vector<column_bucket> envelope_columns_;
+    std::list<std::vector<column_bucket>> ulp_columns_;
     std::vector<std::string> colors_;
+    detail::svg_buffer svg_;
+    bool compact_paths_;
+    bool packed_markers_;
+    bool deduplicate_;
     CoarseReal a_;
     CoarseReal b_;
     int clip_;
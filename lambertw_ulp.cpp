@@ -27,15 +27,18 @@ int main()
     std::string filename = "examples/ulp_lambert_w0_1e_3667.svg";
     auto flo = [](CoarseReal x)->CoarseReal { return lambert_w0<CoarseReal>(x); };
     auto fhi = [](PreciseReal x)->PreciseReal { return lambert_w0<PreciseReal>(x); };
+    auto fhi_prime = [](PreciseReal x)->PreciseReal { return lambert_w0_prime<PreciseReal>(x); };
 
     int clip = 3;
     int horizontal_lines = 5;
     int vertical_lines = 5;
-    auto ulp_plot = quicksvg::ulp_plot<decltype(fhi), PreciseReal, CoarseReal>(fhi, a, b, true, samples);
+    auto ulp_plot = quicksvg::ulp_plot<decltype(fhi), PreciseReal, CoarseReal>(fhi, fhi_prime, a, b, true, samples);
     ulp_plot.add_fn(flo);
-    ulp_plot.write(filename, clip, true, title, 1100, horizontal_lines, vertical_lines);
+    ulp_plot.set_clip(clip);
+    ulp_plot.write(filename, true, title, horizontal_lines, vertical_lines);
     clip = 100;
     filename = "examples/ulp_lambert_w0_1e_3667_clip_" + std::to_string(clip) + ".svg";
-    ulp_plot.write(filename, clip, true, title, 1100, horizontal_lines, vertical_lines);
+    ulp_plot.set_clip(clip);
+    ulp_plot.write(filename, true, title, horizontal_lines, vertical_lines);
 
 }
@@ -1,16 +1,162 @@
+#include <iomanip>
+#include <atomic>
+#include <clocale>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
 #include <boost/math/constants/constants.hpp>
 #include <boost/math/special_functions/gamma.hpp>
 #include <boost/multiprecision/cpp_bin_float.hpp>
 #include "quicksvg/graph_fn.hpp"
 #include "quicksvg/plot_time_series.hpp"
+#include "quicksvg/live_time_series.hpp"
 #include "quicksvg/ulp_plot.hpp"
 #include "quicksvg/scatter_plot.hpp"
+#include "quicksvg/mapped_file.hpp"
 #include "gtest/gtest.h"
 
 using boost::math::constants::pi;
 using boost::multiprecision::cpp_bin_float_50;
 using boost::math::tgamma;
 
+// The contents of a written file, or an empty string if it doesn't exist.
+static std::string slurp(std::string const & filename)
+{
+    std::ifstream ifs(filename, std::ios::binary);
+    return std::string((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+}
+
+TEST(SvgBuffer, formatting)
+{
+    quicksvg::detail::svg_buffer svg;
+    svg << "x='" << 12 << "' " << 1.5 << " " << 2.0f << " " << -0.0001 << " " << 633.14949 << " "
+        << cpp_bin_float_50(0.125) << " " << quicksvg::detail::significant_digits<double>{1234567.0, 4};
+    EXPECT_EQ(svg.str(), "x='12' 1.5 2 0 633.149 0.125 1.235e+06");
+
+    svg.clear();
+    svg.set_precision(1);
+    svg << 0.26;
+    EXPECT_EQ(svg.str(), "0.3");
+    EXPECT_THROW(svg.set_precision(-1), std::domain_error);
+
+    svg.write_to("examples/svg_buffer.txt");
+    EXPECT_EQ(slurp("examples/svg_buffer.txt"), "0.3");
+    // An existing file is replaced:
+    svg << "1";
+    svg.write_to("examples/svg_buffer.txt");
+    EXPECT_EQ(slurp("examples/svg_buffer.txt"), "0.31");
+    EXPECT_THROW(svg.write_to("examples/no_such_directory/svg_buffer.txt"), std::runtime_error);
+    // The temporary is renamed away:
+    for (auto const & entry : std::filesystem::directory_iterator("examples"))
+    {
+        EXPECT_NE(entry.path().filename().string().rfind("svg_buffer.txt.", 0), size_t(0));
+    }
+}
+
+TEST(SvgBuffer, compact_paths)
+{
+    quicksvg::detail::svg_buffer svg;
+    quicksvg::detail::path_writer path(svg, true, "red", 1);
+    path.move_to(1.0, 2.0);
+    path.line_to(1.54, 2.0);
+    path.line_to(1.54, 1.5);
+    path.line_to(2.0, 2.0);
+    path.line_to(2.01, 2.0);
+    path.line_to(2.2, 1.8);
+    path.close();
+    EXPECT_EQ(svg.str(), "<path transform='scale(0.1)' d='m10 20h5v-5l5 5 2-2' stroke='red' stroke-width='10' fill='none'></path>\n");
+
+    svg.clear();
+    quicksvg::detail::path_writer absolute(svg, false, "red", 1);
+    absolute.move_to(1.0, 2.0);
+    absolute.line_to(1.5, 2.25);
+    absolute.close();
+    EXPECT_EQ(svg.str(), "<path d='M1 2 L1.5 2.25' stroke='red' stroke-width='1' fill='none'></path>\n");
+
+    auto file_size = [](std::string const & filename)->size_t
+    {
+        std::ifstream ifs(filename, std::ios::binary | std::ios::ate);
+        return ifs.tellg();
+    };
+    for (bool compact : {false, true})
+    {
+        std::string filename = compact ? "examples/sine_compact.svg" : "examples/sine_absolute.svg";
+        quicksvg::graph_fn<double> graph(-10.0, 10.0, "", filename, 10000);
+        graph.set_compact_paths(compact);
+        graph.add_fn([](double x)->double { return std::sin(x); });
+        graph.write_all();
+    }
+    EXPECT_LT(3*file_size("examples/sine_compact.svg"), file_size("examples/sine_absolute.svg"));
+}
+
+TEST(Kernels, minmax_and_affine)
+{
+    auto check = [](auto zero)
+    {
+        using T = decltype(zero);
+        // Odd lengths exercise the scalar tails of the vectorized loops.
+        for (size_t n : {0, 1, 7, 33, 1001})
+        {
+            std::vector<T> v(n);
+            for (size_t i = 0; i < n; ++i)
+            {
+                v[i] = static_cast<T>(std::sin(T(i)));
+                if (i % 5 == 3)
+                {
+                    v[i] = std::numeric_limits<T>::quiet_NaN();
+                }
+            }
+            T lo = std::numeric_limits<T>::max();
+            T hi = std::numeric_limits<T>::lowest();
+            T expected_lo = lo;
+            T expected_hi = hi;
+            quicksvg::detail::minmax(v.data(), n, 1, lo, hi);
+            quicksvg::detail::minmax<T>(v.data(), n, 1, expected_lo, expected_hi);
+            EXPECT_EQ(lo, expected_lo);
+            EXPECT_EQ(hi, expected_hi);
+
+            std::vector<double> out(n);
+            quicksvg::detail::affine(v.data(), n, 1, -1.0, 50.0, 100.0, out.data());
+            for (size_t i = 0; i < n; ++i)
+            {
+                if (std::isnan(v[i]))
+                {
+                    EXPECT_TRUE(std::isnan(out[i]));
+                    continue;
+                }
+                EXPECT_DOUBLE_EQ(out[i], 100 + (double(v[i]) + 1)*50);
+            }
+        }
+    };
+    check(0.0f);
+    check(0.0);
+
+    // Strided data goes through the scalar loop:
+    std::vector<double> interleaved{1, -5, 3, 7, -2, 0};
+    double lo = std::numeric_limits<double>::max();
+    double hi = std::numeric_limits<double>::lowest();
+    quicksvg::detail::minmax(interleaved.data(), 3, 2, lo, hi);
+    EXPECT_EQ(lo, -2);
+    EXPECT_EQ(hi, 3);
+}
+
+TEST(AxisMap, screen_space)
+{
+    quicksvg::detail::axis_map<double> x_scale(-1.0, 3.0, 100);
+    EXPECT_DOUBLE_EQ(x_scale(-1.0), 0);
+    EXPECT_DOUBLE_EQ(x_scale(2.0), 75);
+    quicksvg::detail::axis_map<double> y_scale(-1.0, 3.0, 100, true);
+    EXPECT_DOUBLE_EQ(y_scale(3.0), 0);
+    EXPECT_DOUBLE_EQ(y_scale(2.0), 25);
+
+    // A range that double can't resolve still maps correctly:
+    cpp_bin_float_50 lo = 1;
+    cpp_bin_float_50 hi = lo + cpp_bin_float_50("1e-30");
+    quicksvg::detail::axis_map<cpp_bin_float_50> narrow(lo, hi, 100);
+    EXPECT_NEAR(narrow((lo + hi)/2), 50, 1e-9);
+    EXPECT_NEAR(narrow(hi), 100, 1e-9);
+}
+
 TEST(graph_fn, types) {
     {
         float a = -pi<float>();
@@ -70,6 +216,86 @@ TEST(graph_fn, types) {
     }
 }
 
+TEST(graph_fn, adaptive)
+{
+    {
+        // The chords of a line are exact, so only one midpoint per initial segment is evaluated:
+        unsigned calls = 0;
+        quicksvg::graph_fn<double> graph(-1.0, 1.0, "", "examples/adaptive_line.svg", 20);
+        graph.set_adaptive(0.5, 1000);
+        graph.add_fn([&](double x) { ++calls; return x; });
+        graph.write_all();
+        EXPECT_EQ(calls, 20u + 19u);
+    }
+    {
+        // A smoothed step: the evaluations go to the jump, and never exceed the budget.
+        unsigned calls = 0;
+        quicksvg::graph_fn<cpp_bin_float_50> graph(-1, 1, "tanh(50𝑥)", "examples/adaptive_tanh.svg", 20);
+        graph.set_adaptive(0.5, 300);
+        graph.add_fn([&](cpp_bin_float_50 x) { ++calls; return tanh(50*x); });
+        graph.write_all();
+        EXPECT_GT(calls, 40u);
+        EXPECT_LE(calls, 300u);
+    }
+}
+
+TEST(graph_fn, batch)
+{
+    double a = -pi<double>();
+    double b = pi<double>();
+    quicksvg::graph_fn<double> graph(a, b, "", "examples/sine_batch.svg", 1000);
+    size_t calls = 0;
+    graph.add_fn_batch([&](std::vector<double> const & x, std::vector<double> & y)
+    {
+        ++calls;
+        ASSERT_EQ(x.size(), y.size());
+        EXPECT_EQ(x.front(), a);
+        EXPECT_DOUBLE_EQ(x.back(), b);
+        for (size_t i = 0; i < x.size(); ++i)
+        {
+            y[i] = std::sin(x[i]);
+        }
+    });
+    EXPECT_EQ(calls, 1u);
+    // NaNs are still rejected:
+    EXPECT_THROW(graph.add_fn_batch([](std::vector<double> const & x, std::vector<double> & y)
+    {
+        for (size_t i = 0; i < x.size(); ++i)
+        {
+            y[i] = x[i] > 0 ? std::numeric_limits<double>::quiet_NaN() : 0.0;
+        }
+    }), std::domain_error);
+    graph.write_all();
+}
+
+TEST(graph_fn, parallel)
+{
+    auto f = [](cpp_bin_float_50 x) { return sin(x)*exp(-x*x/8); };
+    for (unsigned threads : {1u, 4u})
+    {
+        quicksvg::graph_fn<cpp_bin_float_50> graph(-5, 5, "", "examples/parallel_" + std::to_string(threads) + ".svg", 1000);
+        graph.set_threads(threads);
+        graph.add_fn(f);
+        graph.write_all();
+    }
+    EXPECT_EQ(slurp("examples/parallel_1.svg"), slurp("examples/parallel_4.svg"));
+
+    // Every chunk finds NaNs; the one reported is at the smallest x:
+    quicksvg::graph_fn<double> graph(0.0, 99.0, "", "examples/parallel_nan.svg", 100);
+    graph.set_threads(4);
+    try
+    {
+        graph.add_fn([](double x) { return x >= 10 && int(x) % 10 == 0 ? std::numeric_limits<double>::quiet_NaN() : x; });
+        FAIL() << "The NaN at x = 10 was not reported.";
+    }
+    catch (std::domain_error const & e)
+    {
+        EXPECT_NE(std::string(e.what()).find("x = 10 "), std::string::npos) << e.what();
+    }
+    graph.add_fn([](double x) { return x; });
+    graph.write_all();
+}
+
 TEST(PlotTimeSeries, types)
 {
     {
@@ -150,34 +376,696 @@ TEST(PlotTimeSeries, types)
     }
 }
 
+TEST(PlotTimeSeries, decimation)
+{
+    std::vector<double> v(200000);
+    for (size_t i = 0; i < v.size(); ++i) {
+        v[i] = std::sin(i*0.001) + 0.1*std::sin(i*0.7);
+    }
+    auto count = [](std::string const & s, std::string const & what)
+    {
+        size_t n = 0;
+        for (size_t pos = s.find(what); pos != std::string::npos; pos = s.find(what, pos + 1)) {
+            ++n;
+        }
+        return n;
+    };
+    std::string filename = "examples/decimated_time_series.svg";
+    {
+        quicksvg::plot_time_series pts(0.0, 0.001, "decimated time series", filename);
+        pts.set_decimation(true);
+        pts.add_dataset(v);
+        pts.write_all();
+    }
+    std::string svg = slurp(filename);
+    size_t begin = svg.find("<path");
+    std::string line = svg.substr(begin, svg.find("/>", begin) - begin);
+    // The line has at most first, last, min and max for each of the 1055 pixel columns:
+    EXPECT_LE(count(line, " L"), size_t(4*1055));
+    EXPECT_GT(count(line, " L"), size_t(2*1055));
+    // and so are the dots:
+    EXPECT_LE(count(svg, "<circle"), size_t(4*1055));
+    EXPECT_GT(count(svg, "<circle"), size_t(2*1055));
+
+    // The output grows with the width, not with the number of samples:
+    auto size = [&](size_t n, int width)
+    {
+        std::vector<double> u(n);
+        for (size_t i = 0; i < n; ++i) {
+            u[i] = std::sin(i*1e-6) + 0.1*std::sin(i*0.7);
+        }
+        quicksvg::plot_time_series<double> pts(0.0, 0.001, "decimated time series", filename, width);
+        pts.set_decimation(true);
+        pts.add_dataset(std::move(u));
+        pts.write_all();
+        return slurp(filename).size();
+    };
+    size_t small = size(200000, 1100);
+    EXPECT_LT(size(2000000, 1100), small + small/10);
+    EXPECT_GT(size(2000000, 2200), small + small/2);
+}
+
+TEST(PlotTimeSeries, borrowed_and_moved_datasets)
+{
+    // Interleaved (sin, cos) pairs:
+    std::vector<double> interleaved(100);
+    std::vector<double> v(50);
+    std::vector<double> u(50);
+    for (size_t i = 0; i < v.size(); ++i) {
+        v[i] = std::sin(0.25*i);
+        u[i] = std::cos(0.25*i);
+        interleaved[2*i] = v[i];
+        interleaved[2*i + 1] = u[i];
+    }
+    {
+        quicksvg::plot_time_series pts(0.0, 0.25, "copied", "examples/time_series_copied.svg");
+        pts.add_dataset(v);
+        pts.add_dataset(u, false, "lime", "lightgreen");
+        pts.write_all();
+    }
+    {
+        quicksvg::plot_time_series<double> pts(0.0, 0.25, "copied", "examples/time_series_borrowed.svg");
+        pts.add_dataset(quicksvg::strided_span<double>(interleaved.data(), 50, 2));
+        pts.add_dataset(std::move(u), false, "lime", "lightgreen");
+        pts.write_all();
+    }
+    EXPECT_EQ(slurp("examples/time_series_copied.svg"), slurp("examples/time_series_borrowed.svg"));
+}
+
+TEST(PlotTimeSeries, streaming)
+{
+    std::vector<double> v(300001);
+    for (size_t i = 0; i < v.size(); ++i) {
+        v[i] = std::sin(i*0.0001) + 0.1*std::sin(i*0.3);
+    }
+    {
+        quicksvg::plot_time_series pts(0.0, 0.001, "streamed time series", "examples/time_series_whole.svg");
+        pts.set_decimation(true);
+        pts.add_dataset(v);
+        pts.write_all();
+    }
+    {
+        quicksvg::plot_time_series<double> pts(0.0, 0.001, "streamed time series", "examples/time_series_streamed.svg");
+        size_t id = pts.begin_stream(v.size());
+        // Uneven chunks, so chunk boundaries fall inside pixel columns:
+        for (size_t i = 0; i < v.size(); i += 4093) {
+            size_t n = std::min<size_t>(4093, v.size() - i);
+            pts.append(id, quicksvg::strided_span<double>(v.data() + i, n));
+        }
+        EXPECT_THROW(pts.append(id, std::vector<double>{1.0}), std::domain_error);
+        pts.write_all();
+    }
+    EXPECT_EQ(slurp("examples/time_series_whole.svg"), slurp("examples/time_series_streamed.svg"));
+
+    // A stream is bucketed on the x-range known when it begins, so it matches add_dataset
+    // when the longer dataset comes first:
+    std::vector<double> u(v.begin(), v.begin() + 100003);
+    {
+        quicksvg::plot_time_series<double> pts(0.0, 0.001, "streamed time series", "examples/time_series_whole.svg");
+        pts.set_decimation(true);
+        pts.add_dataset(v);
+        pts.add_dataset(u, true, "lime", "lightgreen");
+        pts.write_all();
+    }
+    {
+        quicksvg::plot_time_series<double> pts(0.0, 0.001, "streamed time series", "examples/time_series_streamed.svg");
+        pts.set_decimation(true);
+        pts.add_dataset(v);
+        size_t id = pts.begin_stream(u.size(), true, "lime", "lightgreen");
+        pts.append(id, u);
+        pts.write_all();
+    }
+    std::string whole = slurp("examples/time_series_whole.svg");
+    EXPECT_EQ(whole, slurp("examples/time_series_streamed.svg"));
+    // When a later dataset widens the x-range, the retained samples are folded into the new columns,
+    // which keeps at most 4 per column but may miss an extreme where the old and new columns straddle:
+    {
+        quicksvg::plot_time_series<double> pts(0.0, 0.001, "streamed time series", "examples/time_series_streamed.svg");
+        size_t id = pts.begin_stream(u.size(), true, "lime", "lightgreen");
+        pts.append(id, u);
+        pts.set_decimation(true);
+        pts.add_dataset(v);
+        pts.write_all();
+    }
+    std::string widened = slurp("examples/time_series_streamed.svg");
+    auto dots = [](std::string const & svg, std::string const & color)
+    {
+        size_t n = 0;
+        for (size_t pos = svg.find(color); pos != std::string::npos; pos = svg.find(color, pos + 1)) {
+            ++n;
+        }
+        return n;
+    };
+    EXPECT_LE(dots(widened, "lightgreen"), dots(whole, "lightgreen"));
+    EXPECT_GT(dots(widened, "lightgreen"), dots(whole, "lightgreen")/2);
+}
+
+TEST(PlotTimeSeries, viewport)
+{
+    std::vector<double> v(1000000);
+    for (size_t i = 0; i < v.size(); ++i) {
+        v[i] = std::sin(i*0.0001) + 0.1*std::sin(i*0.37);
+    }
+    // Samples 1000 to 3000 lie in [250, 750]:
+    {
+        quicksvg::plot_time_series<double> pts(0.0, 0.25, "window", "examples/time_series_window.svg");
+        pts.set_viewport(250.0, 750.0);
+        pts.add_dataset(quicksvg::strided_span<double>(v));
+        pts.write_all();
+    }
+    {
+        std::vector<double> slice(v.begin() + 1000, v.begin() + 3001);
+        quicksvg::plot_time_series<double> pts(250.0, 0.25, "window", "examples/time_series_slice.svg");
+        pts.add_dataset(slice);
+        pts.write_all();
+    }
+    EXPECT_EQ(slurp("examples/time_series_window.svg"), slurp("examples/time_series_slice.svg"));
+
+    // Streams are windowed too, and the y-range comes from the window only:
+    {
+        quicksvg::plot_time_series<double> pts(0.0, 0.25, "window", "examples/time_series_window_decimated.svg");
+        pts.set_decimation(true);
+        pts.set_viewport(10000.0, 60000.0);
+        pts.add_dataset(quicksvg::strided_span<double>(v));
+        size_t id = pts.begin_stream(v.size(), false);
+        pts.append(id, v);
+        pts.write_all();
+    }
+
+    quicksvg::plot_time_series<double> empty(0.0, 0.25, "window", "examples/time_series_window_empty.svg");
+    EXPECT_THROW(empty.set_viewport(2.0, 1.0), std::domain_error);
+    empty.set_viewport(1e7, 2e7);
+    empty.add_dataset(quicksvg::strided_span<double>(v));
+    EXPECT_THROW(empty.write_all(), std::domain_error);
+}
+
+TEST(PlotTimeSeries, timestamps)
+{
+    // Count of subpaths in the first <path>, i.e. pieces of the line:
+    auto pieces = [](std::string const & svg)->size_t
+    {
+        size_t begin = svg.find("<path");
+        std::string d = svg.substr(begin, svg.find("/>", begin) - begin);
+        return std::count(d.begin(), d.end(), 'M');
+    };
+    // Irregular sampling with three outages longer than a second:
+    std::vector<double> t;
+    std::vector<double> v;
+    std::mt19937_64 gen(7);
+    std::uniform_real_distribution<double> dis(0.001, 0.01);
+    double now = 0;
+    for (size_t i = 0; i < 100000; ++i) {
+        if (i == 25000 || i == 50000 || i == 75000) {
+            now += 5;
+        }
+        now += dis(gen);
+        t.push_back(now);
+        v.push_back(std::sin(now) + 0.1*std::sin(37*now));
+    }
+    {
+        quicksvg::plot_time_series<double> pts(0.0, 1.0, "irregular", "examples/time_series_irregular.svg");
+        pts.set_max_gap(1.0);
+        pts.add_dataset(t, v);
+        pts.write_all();
+        EXPECT_EQ(pieces(slurp("examples/time_series_irregular.svg")), size_t(4));
+    }
+    {
+        quicksvg::plot_time_series<double> pts(0.0, 1.0, "irregular", "examples/time_series_irregular_decimated.svg");
+        pts.set_decimation(true);
+        pts.set_max_gap(1.0);
+        pts.add_dataset(quicksvg::strided_span<double>(t), quicksvg::strided_span<double>(v), true, "steelblue", "");
+        pts.write_all();
+        std::string svg = slurp("examples/time_series_irregular_decimated.svg");
+        EXPECT_EQ(pieces(svg), size_t(4));
+        EXPECT_LT(svg.size(), slurp("examples/time_series_irregular.svg").size()/10);
+    }
+
+    // The viewport is found by binary search; it matches plotting the slice by itself:
+    size_t first = 30000;
+    size_t last = 40000;
+    {
+        quicksvg::plot_time_series<double> pts(0.0, 1.0, "irregular", "examples/time_series_irregular_window.svg");
+        pts.set_viewport(t[first], t[last]);
+        pts.add_dataset(t, v);
+        pts.write_all();
+    }
+    {
+        quicksvg::plot_time_series<double> pts(0.0, 1.0, "irregular", "examples/time_series_irregular_slice.svg");
+        pts.add_dataset(std::vector<double>(t.begin() + first, t.begin() + last + 1),
+                        std::vector<double>(v.begin() + first, v.begin() + last + 1));
+        pts.write_all();
+    }
+    EXPECT_EQ(slurp("examples/time_series_irregular_window.svg"), slurp("examples/time_series_irregular_slice.svg"));
+
+    quicksvg::plot_time_series<double> bad(0.0, 1.0, "irregular", "examples/time_series_irregular_bad.svg");
+    std::swap(t[10], t[11]);
+    EXPECT_THROW(bad.add_dataset(t, v), std::domain_error);
+    t.pop_back();
+    EXPECT_THROW(bad.add_dataset(t, v), std::domain_error);
+    EXPECT_THROW(bad.set_max_gap(0.0), std::domain_error);
+    bad.add_dataset(v);
+    bad.write_all();
+}
+
+TEST(PlotTimeSeries, tiles)
+{
+    std::vector<double> v(20000);
+    for (size_t i = 0; i < v.size(); ++i)
+    {
+        v[i] = std::sin(0.001*i) + 0.2*std::sin(0.31*i);
+    }
+    // 455 columns per tile; 20000 columns at level 0 need 6 halvings to fit in one tile:
+    {
+        quicksvg::plot_time_series<double> plot(0, 0.01, "tiles", "examples/pyramid_a.svg", 500);
+        plot.set_packed_markers(true);
+        plot.add_dataset(v);
+        plot.write_tiles();
+    }
+    std::string index = slurp("examples/pyramid_a.json");
+    EXPECT_NE(index.find("{\"level\": 0, \"samples_per_column\": 1, \"samples_per_tile\": 455, \"tiles\": 44, \"file\": \"pyramid_a_0_{tile}.svg\"}"), std::string::npos);
+    EXPECT_NE(index.find("{\"level\": 6, \"samples_per_column\": 64, \"samples_per_tile\": 29120, \"tiles\": 1,"), std::string::npos);
+    EXPECT_EQ(index.find("\"level\": 7"), std::string::npos);
+    EXPECT_FALSE(slurp("examples/pyramid_a_0_43.svg").empty());
+    EXPECT_FALSE(slurp("examples/pyramid_a_3_5.svg").empty());
+    EXPECT_TRUE(slurp("examples/pyramid_a_3_6.svg").empty());
+
+    // Level 2 is merged from level 1, which is merged from level 0 across tile boundaries (455 is odd);
+    // it must be identical to a pyramid whose level 0 is bucketed 4 samples at a time directly:
+    {
+        quicksvg::plot_time_series<double> plot(0, 0.01, "tiles", "examples/pyramid_b.svg", 500);
+        plot.set_packed_markers(true);
+        plot.add_dataset(v);
+        plot.write_tiles(4);
+    }
+    for (std::string tile : {"0", "5", "10"})
+    {
+        EXPECT_EQ(slurp("examples/pyramid_a_2_" + tile + ".svg"), slurp("examples/pyramid_b_0_" + tile + ".svg"));
+    }
+    EXPECT_EQ(slurp("examples/pyramid_a_6_0.svg"), slurp("examples/pyramid_b_4_0.svg"));
+
+    // Dots in the directory aren't an extension, and a name without one gets tiles without one:
+    std::filesystem::create_directories("examples/pyramid.d");
+    {
+        quicksvg::plot_time_series<double> plot(0, 0.01, "tiles", "examples/pyramid.d/noext", 500);
+        plot.add_dataset(std::vector<double>(v.begin(), v.begin() + 1000));
+        plot.write_tiles();
+    }
+    index = slurp("examples/pyramid.d/noext.json");
+    EXPECT_NE(index.find("\"file\": \"noext_0_{tile}\"}"), std::string::npos);
+    EXPECT_FALSE(slurp("examples/pyramid.d/noext_0_2").empty());
+    EXPECT_FALSE(slurp("examples/pyramid.d/noext_2_0").empty());
+
+    quicksvg::plot_time_series<double> streamed(0, 0.01, "tiles", "examples/pyramid_c.svg");
+    streamed.append(streamed.begin_stream(10), std::vector<double>(10, 1.0));
+    EXPECT_THROW(streamed.write_tiles(), std::domain_error);
+    streamed.write_all();
+}
+
+TEST(LiveTimeSeries, rolling_window)
+{
+    auto frame = [](std::string const & svg)->std::string
+    {
+        return svg.substr(0, svg.find("<path"));
+    };
+    std::string filename = "examples/live_time_series.svg";
+    quicksvg::live_time_series<double> live(0.01, 1000, "live", filename);
+    EXPECT_THROW(live.write(), std::logic_error);
+    std::vector<double> chunk(300);
+    for (size_t refresh = 0; refresh < 10; ++refresh) {
+        for (size_t i = 0; i < chunk.size(); ++i) {
+            chunk[i] = std::sin(0.01*(refresh*chunk.size() + i));
+        }
+        live.push(chunk);
+        live.write();
+    }
+    EXPECT_EQ(live.size(), size_t(1000));
+    std::string svg = slurp(filename);
+    size_t begin = svg.find("<path");
+    std::string d = svg.substr(begin, svg.find("/>", begin) - begin);
+    EXPECT_EQ(std::count(d.begin(), d.end(), 'L'), 999);
+    // The newest sample, sin(29.99), is at the right edge:
+    EXPECT_NE(d.find("L1055 "), std::string::npos);
+
+    // The automatic range is rounded out to gridlines, so another period of the same signal keeps the frame:
+    std::string before = slurp(filename);
+    for (size_t i = 0; i < chunk.size(); ++i) {
+        chunk[i] = 0.9*std::sin(0.01*i);
+    }
+    live.push(chunk);
+    live.write();
+    EXPECT_EQ(frame(before), frame(slurp(filename)));
+
+    // With a fixed y-range the frame is the same on every refresh:
+    live.set_y_range(-1.5, 1.5);
+    live.write();
+    before = slurp(filename);
+    live.push(std::vector<double>(5000, 0.25));
+    live.write();
+    std::string after = slurp(filename);
+    EXPECT_EQ(frame(before), frame(after));
+    EXPECT_NE(before, after);
+
+    quicksvg::live_time_series<float> partial(0.5f, 100, "partial", "examples/live_time_series_partial.svg");
+    partial.push(1.0f);
+    partial.push(2.0f);
+    partial.write();
+    EXPECT_THROW(quicksvg::live_time_series<double>(0.1, 1, "", filename), std::domain_error);
+}
+
+TEST(LiveTimeSeries, flat_window)
+{
+    // One sample, then a window of identical samples: neither has a y-extent to scale by.
+    std::string filename = "examples/live_time_series_flat.svg";
+    quicksvg::live_time_series<double> live(0.01, 100, "flat", filename);
+    live.push(3.0);
+    live.write();
+    std::string svg = slurp(filename);
+    EXPECT_EQ(svg.find("nan"), std::string::npos);
+    EXPECT_EQ(svg.find("inf"), std::string::npos);
+    EXPECT_NE(svg.find("<path d='M1055 "), std::string::npos);
+
+    live.push(std::vector<double>(100, 3.0));
+    live.write();
+    svg = slurp(filename);
+    EXPECT_EQ(svg.find("nan"), std::string::npos);
+    EXPECT_EQ(svg.find("inf"), std::string::npos);
+    size_t begin = svg.find("<path");
+    std::string d = svg.substr(begin, svg.find("/>", begin) - begin);
+    EXPECT_EQ(std::count(d.begin(), d.end(), 'L'), 99);
+
+    quicksvg::live_time_series<float> zeros(0.5f, 10, "zeros", "examples/live_time_series_zeros.svg");
+    zeros.push(std::vector<float>(10, 0.0f));
+    zeros.write();
+    svg = slurp("examples/live_time_series_zeros.svg");
+    EXPECT_EQ(svg.find("nan"), std::string::npos);
+}
+
+TEST(LiveTimeSeries, nan_window)
+{
+    double nan = std::numeric_limits<double>::quiet_NaN();
+    std::string filename = "examples/live_time_series_nan.svg";
+    quicksvg::live_time_series<double> live(0.01, 10, "gaps", filename);
+    live.set_precision(1);
+    live.push(std::vector<double>(10, nan));
+    live.write();
+    std::string svg = slurp(filename);
+    EXPECT_EQ(svg.find("nan"), std::string::npos);
+    EXPECT_EQ(svg.find("<path"), std::string::npos);
+
+    // NaNs break the line, and the new precision shows in the coordinates:
+    live.push(std::vector<double>{1, 2, nan, 3, 4});
+    live.write();
+    svg = slurp(filename);
+    EXPECT_EQ(svg.find("nan"), std::string::npos);
+    size_t begin = svg.find("<path");
+    std::string d = svg.substr(begin, svg.find("/>", begin) - begin);
+    EXPECT_EQ(std::count(d.begin(), d.end(), 'M'), 2);
+    EXPECT_EQ(std::count(d.begin(), d.end(), 'L'), 2);
+    EXPECT_NE(d.find("L1055 "), std::string::npos);
+    EXPECT_EQ(d.find(".00"), std::string::npos);
+
+    // The bitmap is drawn on the same image every time:
+    quicksvg::live_time_series<double> bitmap(0.01, 10, "bitmap", "examples/live_time_series.ppm", 200);
+    bitmap.push(std::vector<double>{1, 2, 3});
+    bitmap.write();
+    std::string first = slurp("examples/live_time_series.ppm");
+    bitmap.push(std::vector<double>(10, 2.0));
+    bitmap.write();
+    bitmap.push(std::vector<double>{1, 2, 3});
+    bitmap.write();
+    std::string redrawn = slurp("examples/live_time_series.ppm");
+    EXPECT_EQ(first.size(), redrawn.size());
+    // Nothing of the earlier refreshes is left on it:
+    quicksvg::live_time_series<double> fresh(0.01, 10, "bitmap", "examples/live_time_series.ppm", 200);
+    fresh.push(std::vector<double>(7, 2.0));
+    fresh.push(std::vector<double>{1, 2, 3});
+    fresh.write();
+    EXPECT_TRUE(redrawn == slurp("examples/live_time_series.ppm"));
+}
+
+TEST(MappedFile, binary_and_csv)
+{
+    std::vector<double> x(20000);
+    std::vector<double> y(x.size());
+    std::vector<double> interleaved(2*x.size());
+    for (size_t i = 0; i < x.size(); ++i) {
+        x[i] = std::cos(0.001*i)*(1 + 0.0001*i);
+        y[i] = std::sin(0.001*i)*(1 + 0.0001*i);
+        interleaved[2*i] = x[i];
+        interleaved[2*i + 1] = y[i];
+    }
+    {
+        std::ofstream ofs("examples/spiral.bin", std::ios::binary);
+        ofs.write(reinterpret_cast<char const *>(interleaved.data()), interleaved.size()*sizeof(double));
+        std::ofstream csv("examples/spiral.csv");
+        csv << std::setprecision(17) << "t, x, y\r\n";
+        for (size_t i = 0; i < x.size(); ++i) {
+            csv << i << ", " << x[i] << "," << y[i] << (i % 1000 == 0 ? "\r\n\n" : "\n");
+        }
+    }
+
+    quicksvg::mapped_array<double> binary("examples/spiral.bin", 2);
+    ASSERT_EQ(binary.records(), x.size());
+    EXPECT_EQ(binary.column(1)[123], y[123]);
+    EXPECT_THROW(quicksvg::mapped_array<double>("examples/spiral.bin", 3), std::domain_error);
+
+    auto columns = quicksvg::load_csv_columns<double>("examples/spiral.csv", {2, 1}, true, 7);
+    EXPECT_EQ(columns[0], y);
+    EXPECT_EQ(columns[1], x);
+    EXPECT_THROW(quicksvg::load_csv_column<double>("examples/spiral.csv", 1, false), std::domain_error);
+    EXPECT_THROW(quicksvg::load_csv_column<double>("examples/spiral.csv", 3, true), std::domain_error);
+    auto serial = quicksvg::load_csv_column<float>("examples/spiral.csv", 1, true, 1);
+    ASSERT_EQ(serial.size(), x.size());
+    EXPECT_EQ(serial[777], float(x[777]));
+
+    {
+        quicksvg::scatter_plot<double> plot("spiral", "examples/spiral_vectors.svg");
+        plot.add_dataset(x, y);
+        plot.write_all();
+    }
+    {
+        quicksvg::scatter_plot<double> plot("spiral", "examples/spiral_mapped.svg");
+        plot.add_dataset(binary.column(0), binary.column(1));
+        plot.write_all();
+    }
+    EXPECT_EQ(slurp("examples/spiral_vectors.svg"), slurp("examples/spiral_mapped.svg"));
+    {
+        quicksvg::plot_time_series<double> pts(0.0, 1.0, "spiral", "examples/spiral_time_series.svg");
+        pts.add_dataset(quicksvg::load_csv_column<double>("examples/spiral.csv", 2, true));
+        pts.write_all();
+    }
+
+    // The decimal point is '.' whatever the locale says:
+    {
+        std::ofstream csv("examples/points.csv");
+        csv << "x,y\n+1.5,-2.25\n3,4e-1\n1e-400,1e400\n";
+    }
+    std::vector<std::vector<double>> expected{{1.5, 3, 0}, {-2.25, 0.4, std::numeric_limits<double>::infinity()}};
+    EXPECT_EQ(quicksvg::load_csv_columns<double>("examples/points.csv", {0, 1}, true), expected);
+    for (char const * name : {"de_DE.UTF-8", "de_DE.utf8", "fr_FR.UTF-8", "fr_FR.utf8"})
+    {
+        if (std::setlocale(LC_NUMERIC, name))
+        {
+            EXPECT_EQ(quicksvg::load_csv_columns<double>("examples/points.csv", {0, 1}, true), expected);
+            EXPECT_EQ(quicksvg::load_csv_column<long double>("examples/points.csv", 0, true)[0], 1.5L);
+            std::setlocale(LC_NUMERIC, "C");
+            break;
+        }
+    }
+}
+
 TEST(ULPPlot, types)
 {
+    auto hi = [](cpp_bin_float_50 x)->cpp_bin_float_50 { return tgamma(x); };
+    using hi_t = decltype(hi);
+    // Few samples; this is about the types:
+    int samples = 1000;
     {
-        int samples = 10000;
         float a = 1;
         float b = 15;
         std::string title = "ULP accuracy of float precision gamma on [1, 15]";
         std::string filename = "examples/ulp_gamma_float.svg";
-        quicksvg::ulp_plot(tgamma<float>, tgamma<cpp_bin_float_50>, a, b, title, filename, samples);
+        quicksvg::ulp_plot<hi_t, cpp_bin_float_50, float> plot(hi, a, b, true, samples, -1, 0);
+        plot.add_fn([](float x)->float { return tgamma(x); });
+        plot.write(filename, true, title);
     }
     {
-        int samples = 10000;
         double a = 1;
         double b = 15;
-        std::string title = "ULP accuracy of double precision sin on [1, 15]";
+        std::string title = "ULP accuracy of double precision gamma on [1, 15]";
         std::string filename = "examples/ulp_gamma_double.svg";
-        quicksvg::ulp_plot(tgamma<double>, tgamma<cpp_bin_float_50>, a, b, title, filename, samples);
+        quicksvg::ulp_plot<hi_t, cpp_bin_float_50, double> plot(hi, a, b, true, samples, -1, 0);
+        plot.add_fn([](double x)->double { return tgamma(x); });
+        plot.write(filename, true, title);
     }
     {
-        int samples = 10000;
         long double a = 1;
         long double b = 15;
-        std::string title = "ULP accuracy of long double precision sin on [1, 15]";
+        std::string title = "ULP accuracy of long double precision gamma on [1, 15]";
         std::string filename = "examples/ulp_gamma_long_double.svg";
-        quicksvg::ulp_plot(tgamma<long double>, tgamma<cpp_bin_float_50>, a, b, title, filename, samples);
+        quicksvg::ulp_plot<hi_t, cpp_bin_float_50, long double> plot(hi, a, b, true, samples, -1, 0);
+        plot.add_fn([](long double x)->long double { return tgamma(x); });
+        plot.write(filename, true, title);
     }
 }
 
+TEST(ULPPlot, parallel)
+{
+    auto hi = [](cpp_bin_float_50 x)->cpp_bin_float_50 { return tgamma(x); };
+    auto lo = [](double x)->double { return tgamma(x); };
+    size_t samples = 1000;
+    int seed = 7;
+    quicksvg::ulp_plot<decltype(hi), cpp_bin_float_50, double> serial(hi, 1.0, 15.0, true, samples, seed, 1);
+    quicksvg::ulp_plot<decltype(hi), cpp_bin_float_50, double> parallel(hi, 1.0, 15.0, true, samples, seed, 4);
+    serial.add_fn(lo);
+    parallel.add_fn(lo);
+    serial.write("examples/ulp_gamma_serial.svg");
+    parallel.write("examples/ulp_gamma_parallel.svg");
+    EXPECT_EQ(slurp("examples/ulp_gamma_serial.svg"), slurp("examples/ulp_gamma_parallel.svg"));
+}
+
+TEST(ULPPlot, derivative_envelope)
+{
+    size_t evaluations = 0;
+    auto hi = [&](cpp_bin_float_50 x)->cpp_bin_float_50 { ++evaluations; return sin(x); };
+    auto hi_prime = [](cpp_bin_float_50 x)->cpp_bin_float_50 { return cos(x); };
+    auto lo = [](double x)->double { return std::sin(x); };
+    size_t samples = 1000;
+    quicksvg::ulp_plot<decltype(hi), cpp_bin_float_50, double> plot(hi, hi_prime, 0.5, 3.0, true, samples);
+    EXPECT_EQ(evaluations, samples);
+    plot.add_fn(lo);
+    plot.write("examples/ulp_sin_derivative_envelope.svg");
+}
+
+TEST(ULPPlot, cache)
+{
+    size_t evaluations = 0;
+    auto hi = [&](cpp_bin_float_50 x)->cpp_bin_float_50 { ++evaluations; return tgamma(x); };
+    auto lo = [](double x)->double { return tgamma(x); };
+    size_t samples = 500;
+    std::remove("examples/ulp_gamma.cache");
+    quicksvg::ulp_cache cache{"examples/ulp_gamma.cache", "tgamma"};
+    {
+        quicksvg::ulp_plot<decltype(hi), cpp_bin_float_50, double> plot(hi, 1.0, 15.0, true, samples, 3, 1, cache);
+        plot.add_fn(lo);
+        plot.write("examples/ulp_gamma_uncached.svg");
+    }
+    EXPECT_GT(evaluations, samples);
+    evaluations = 0;
+    {
+        quicksvg::ulp_plot<decltype(hi), cpp_bin_float_50, double> plot(hi, 1.0, 15.0, true, samples, 3, 1, cache);
+        plot.add_fn(lo);
+        plot.write("examples/ulp_gamma_cached.svg");
+    }
+    EXPECT_EQ(evaluations, size_t(0));
+    EXPECT_EQ(slurp("examples/ulp_gamma_uncached.svg"), slurp("examples/ulp_gamma_cached.svg"));
+
+    // A different key recomputes:
+    quicksvg::ulp_plot<decltype(hi), cpp_bin_float_50, double> plot(hi, 1.0, 15.0, true, samples, 4, 1, cache);
+    EXPECT_GT(evaluations, samples);
+
+    // A truncated or padded file is not trusted:
+    std::string contents = slurp(cache.filename);
+    for (std::string damaged : {contents.substr(0, contents.size()/2), contents + "junk"})
+    {
+        std::ofstream(cache.filename, std::ios::binary) << damaged;
+        evaluations = 0;
+        quicksvg::ulp_plot<decltype(hi), cpp_bin_float_50, double> recomputed(hi, 1.0, 15.0, true, samples, 4, 1, cache);
+        EXPECT_GT(evaluations, samples);
+        EXPECT_EQ(slurp(cache.filename), contents);
+    }
+    EXPECT_THROW((quicksvg::ulp_plot<decltype(hi), cpp_bin_float_50, double>(hi, 1.0, 15.0, true, samples, -1, 1, cache)), std::domain_error);
+}
+
+TEST(ULPPlot, exhaustive)
+{
+    auto hi = [](double x)->double { return std::exp(x); };
+    // Every float in [1, 1.01] is visited, so a single bad value cannot be missed:
+    float bad_x = std::nextafter(1.005f, 2.0f);
+    auto lo = [&](float x)->float { return x == bad_x ? 2*std::exp(x) : std::exp(x); };
+    quicksvg::ulp_plot<decltype(hi), double, float> plot(hi, 1.0f, 1.01f, quicksvg::exhaustive, 2, 500);
+    plot.add_fn(lo);
+    plot.set_clip(20);
+    plot.write("examples/ulp_exp_exhaustive.svg");
+
+    std::string svg = slurp("examples/ulp_exp_exhaustive.svg");
+    // The output is bounded by the number of columns, not the ~80,000 floats in the interval:
+    EXPECT_LT(svg.size(), size_t(100000));
+
+    // However many functions are compared, the reference is evaluated once per float:
+    std::atomic<size_t> evaluations{0};
+    auto counted = [&](double x)->double { ++evaluations; return std::exp(x); };
+    quicksvg::ulp_plot<decltype(counted), double, float> several(counted, 1.0f, 1.01f, quicksvg::exhaustive, 2, 500);
+    several.add_fn(lo);
+    several.add_fn([](float x)->float { return std::exp(x); }, "orange");
+    several.add_fn([](float x)->float { return std::expm1(x) + 1; }, "red");
+    EXPECT_EQ(evaluations.load(), size_t(0));
+    several.write("examples/ulp_exp_exhaustive_several.svg", false);
+    float a = 1.0f;
+    float b = 1.01f;
+    std::uint32_t first;
+    std::uint32_t last;
+    std::memcpy(&first, &a, sizeof(a));
+    std::memcpy(&last, &b, sizeof(b));
+    EXPECT_EQ(evaluations.load(), size_t(last - first + 1));
+    // Writing again reuses the buckets:
+    several.write("examples/ulp_exp_exhaustive_several.svg", false);
+    EXPECT_EQ(evaluations.load(), size_t(last - first + 1));
+
+    // The envelope by finite differences costs several more evaluations per float; with the derivative, none:
+    evaluations = 0;
+    quicksvg::ulp_plot<decltype(counted), double, float> differenced(counted, 1.0f, 1.01f, quicksvg::exhaustive, 2, 500);
+    differenced.add_fn(lo);
+    differenced.write("examples/ulp_exp_exhaustive_envelope.svg");
+    EXPECT_GT(evaluations.load(), 4*size_t(last - first + 1));
+    evaluations = 0;
+    auto derivative = [](double x)->double { return std::exp(x); };
+    quicksvg::ulp_plot<decltype(counted), double, float> derived(counted, derivative, 1.0f, 1.01f, quicksvg::exhaustive, 2, 500);
+    derived.add_fn(lo);
+    derived.write("examples/ulp_exp_exhaustive_envelope.svg");
+    EXPECT_EQ(evaluations.load(), size_t(last - first + 1));
+}
+
+TEST(PixelSet, edges)
+{
+    quicksvg::detail::pixel_set drawn(10, 5);
+    EXPECT_TRUE(drawn.insert(9.5, 4.5));
+    // The far edges are the last pixel, not off the graph:
+    EXPECT_FALSE(drawn.insert(10, 4.2));
+    EXPECT_FALSE(drawn.insert(9.1, 5));
+    EXPECT_FALSE(drawn.insert(10, 5));
+    EXPECT_TRUE(drawn.insert(0, 0));
+    EXPECT_FALSE(drawn.insert(0.9, 0.9));
+    // Points truly outside are never merged:
+    EXPECT_TRUE(drawn.insert(10.5, 1));
+    EXPECT_TRUE(drawn.insert(10.5, 1));
+    EXPECT_TRUE(drawn.insert(-0.5, 1));
+    EXPECT_TRUE(drawn.insert(std::numeric_limits<double>::quiet_NaN(), 1));
+    drawn.clear();
+    EXPECT_TRUE(drawn.insert(10, 5));
+    quicksvg::detail::pixel_set empty(0, 0);
+    EXPECT_TRUE(empty.insert(0, 0));
+    EXPECT_TRUE(empty.insert(0, 0));
+}
+
+TEST(ULPPlot, deduplicate)
+{
+    auto hi = [](double x)->double { return std::exp(x); };
+    auto lo = [](float x)->float { return std::exp(x); };
+    quicksvg::ulp_plot<decltype(hi), double, float> plot(hi, 1.0f, 2.0f, true, 100000, 12);
+    plot.add_fn(lo);
+    plot.set_width(200);
+    plot.write("examples/ulp_exp_all_points.svg", false);
+    plot.set_deduplicate(true);
+    plot.write("examples/ulp_exp_deduplicated.svg", false);
+
+    std::string all = slurp("examples/ulp_exp_all_points.svg");
+    std::string distinct = slurp("examples/ulp_exp_deduplicated.svg");
+    // 100,000 points on a graph of about 15,000 pixels:
+    EXPECT_LT(4*distinct.size(), all.size());
+    EXPECT_NE(distinct.find("<circle"), std::string::npos);
+}
+
 TEST(ScatterPlot, types)
 {
     {
@@ -239,6 +1127,264 @@ TEST(ScatterPlot, types)
 
 }
 
+TEST(ScatterPlot, packed_markers)
+{
+    auto count = [](std::string const & haystack, std::string const & needle)->size_t
+    {
+        size_t n = 0;
+        for (size_t pos = haystack.find(needle); pos != std::string::npos; pos = haystack.find(needle, pos + 1)) {
+            ++n;
+        }
+        return n;
+    };
+    int n = 20000;
+    std::vector<std::pair<double, double>> v(n);
+    std::mt19937 gen(12);
+    std::normal_distribution<double> dis;
+    for (int i = 0; i < n; ++i) {
+        v[i] = {dis(gen), dis(gen)};
+    }
+    for (bool packed : {false, true})
+    {
+        std::string filename = packed ? "examples/scatter_plot_packed.svg" : "examples/scatter_plot_circles.svg";
+        quicksvg::scatter_plot<double> scatter("Scatter plot", filename);
+        scatter.set_packed_markers(packed);
+        scatter.set_compact_paths(packed);
+        scatter.add_dataset(v);
+        scatter.write_all();
+    }
+    std::string circles = slurp("examples/scatter_plot_circles.svg");
+    std::string packed = slurp("examples/scatter_plot_packed.svg");
+    EXPECT_EQ(count(circles, "<circle"), size_t(n));
+    EXPECT_EQ(count(packed, "<circle"), size_t(0));
+    EXPECT_EQ(count(packed, "<path"), size_t(1));
+    EXPECT_LT(4*packed.size(), circles.size());
+}
+
+TEST(ScatterPlot, columnar_datasets)
+{
+    int n = 1000;
+    std::vector<std::pair<double, double>> pairs(n);
+    std::vector<double> xs(n);
+    std::vector<double> ys(n);
+    // x and y interleaved, as in a point cloud read from disk:
+    std::vector<double> xy(2*n);
+    for (int i = 0; i < n; ++i)
+    {
+        xs[i] = std::cos(0.01*i);
+        ys[i] = std::sin(0.03*i);
+        pairs[i] = {xs[i], ys[i]};
+        xy[2*i] = xs[i];
+        xy[2*i+1] = ys[i];
+    }
+    {
+        quicksvg::scatter_plot<double> scatter("Lissajous", "examples/scatter_pairs.svg");
+        scatter.add_dataset(pairs);
+        scatter.write_all();
+    }
+    {
+        quicksvg::scatter_plot<double> scatter("Lissajous", "examples/scatter_columns.svg");
+        scatter.add_dataset(xs, ys);
+        scatter.write_all();
+    }
+    {
+        quicksvg::scatter_plot<double> scatter("Lissajous", "examples/scatter_moved.svg");
+        scatter.add_dataset(std::vector<double>(xs), std::vector<double>(ys));
+        scatter.write_all();
+    }
+    {
+        quicksvg::scatter_plot<double> scatter("Lissajous", "examples/scatter_borrowed.svg");
+        scatter.add_dataset(quicksvg::strided_span<double>(xy.data(), n, 2), quicksvg::strided_span<double>(xy.data() + 1, n, 2));
+        scatter.write_all();
+    }
+    std::string expected = slurp("examples/scatter_pairs.svg");
+    EXPECT_EQ(slurp("examples/scatter_columns.svg"), expected);
+    EXPECT_EQ(slurp("examples/scatter_moved.svg"), expected);
+    EXPECT_EQ(slurp("examples/scatter_borrowed.svg"), expected);
+
+    quicksvg::scatter_plot<double> scatter("", "examples/scatter_mismatched.svg");
+    EXPECT_THROW(scatter.add_dataset(quicksvg::strided_span<double>(xs), quicksvg::strided_span<double>(ys.data(), n - 1)), std::domain_error);
+    scatter.add_dataset(pairs);
+    scatter.write_all();
+}
+
+TEST(ScatterPlot, density)
+{
+    size_t n = 1000000;
+    std::vector<float> xs(n);
+    std::vector<float> ys(n);
+    std::mt19937 gen(7);
+    std::normal_distribution<float> dis(0, 1);
+    for (size_t i = 0; i < n; ++i)
+    {
+        xs[i] = dis(gen);
+        ys[i] = xs[i]*0.5f + dis(gen);
+    }
+    for (unsigned threads : {1u, 4u})
+    {
+        for (bool png : {false, true})
+        {
+            std::string filename = "examples/scatter_density_" + std::string(png ? "png" : "rect") + std::to_string(threads) + ".svg";
+            quicksvg::scatter_plot<float> scatter("Correlated normals", filename);
+            scatter.set_density(4, png);
+            scatter.set_threads(threads);
+            scatter.add_dataset(quicksvg::strided_span<float>(xs), quicksvg::strided_span<float>(ys));
+            scatter.write_all();
+        }
+    }
+    std::string rects = slurp("examples/scatter_density_rect1.svg");
+    std::string png = slurp("examples/scatter_density_png1.svg");
+    EXPECT_EQ(rects, slurp("examples/scatter_density_rect4.svg"));
+    EXPECT_EQ(png, slurp("examples/scatter_density_png4.svg"));
+    EXPECT_EQ(rects.find("<circle"), std::string::npos);
+    EXPECT_NE(png.find("data:image/png;base64,iVBORw0KGgo"), std::string::npos);
+    // A million points in well under a byte each:
+    EXPECT_LT(rects.size(), size_t(1000000));
+    EXPECT_LT(png.size(), size_t(100000));
+}
+
+TEST(Raster, png_and_ppm)
+{
+    std::vector<double> v(100000);
+    for (size_t i = 0; i < v.size(); ++i)
+    {
+        v[i] = std::sin(0.001*i);
+    }
+    for (std::string extension : {".svg", ".png", ".ppm"})
+    {
+        quicksvg::plot_time_series<double> plot(0, 0.001, "", "examples/raster_sine" + extension);
+        plot.set_packed_markers(true);
+        plot.add_dataset(v);
+        plot.write_all();
+    }
+    std::string png = slurp("examples/raster_sine.png");
+    EXPECT_EQ(png.substr(0, 8), std::string("\x89PNG\r\n\x1a\n", 8));
+    // The bitmap doesn't grow with the number of points:
+    EXPECT_LT(10*png.size(), slurp("examples/raster_sine.svg").size());
+
+    std::string ppm = slurp("examples/raster_sine.ppm");
+    std::string header = "P6\n1100 679\n255\n";
+    ASSERT_EQ(ppm.substr(0, header.size()), header);
+    ASSERT_EQ(ppm.size(), header.size() + 1100*679*3);
+    // Black background, the orange of the dots and the gray of the axes:
+    size_t orange = 0;
+    size_t black = 0;
+    for (size_t i = header.size(); i < ppm.size(); i += 3)
+    {
+        unsigned char r = ppm[i];
+        unsigned char g = ppm[i+1];
+        unsigned char b = ppm[i+2];
+        black += (r == 0 && g == 0 && b == 0);
+        orange += (r == 255 && g == 165 && b == 0);
+    }
+    EXPECT_GT(black, size_t(1100*679/2));
+    EXPECT_GT(orange, size_t(1000));
+
+    // The paths reach the bitmap in batches of points; the image is the same as the one drawn from the SVG text:
+    for (std::string extension : {".svg", ".ppm"})
+    {
+        quicksvg::plot_time_series<double> plot(0, 0.001, "", "examples/raster_batches" + extension);
+        plot.set_precision(17);
+        plot.add_dataset(v);
+        plot.write_all();
+    }
+    quicksvg::detail::svg_rasterizer from_text;
+    std::string svg = slurp("examples/raster_batches.svg");
+    // All but the final newline:
+    EXPECT_EQ(from_text.consume(svg), svg.size() - 1);
+    from_text.write("examples/raster_from_text.ppm");
+    EXPECT_TRUE(slurp("examples/raster_from_text.ppm") == slurp("examples/raster_batches.ppm"));
+
+    // The title is drawn too, white in the top margin:
+    auto white_on_top = [&](std::string const & image)
+    {
+        size_t white = 0;
+        for (size_t i = header.size(); i < header.size() + 1100*30*3; i += 3)
+        {
+            white += ((unsigned char) image[i] == 255 && (unsigned char) image[i+1] == 255 && (unsigned char) image[i+2] == 255);
+        }
+        return white;
+    };
+    EXPECT_EQ(white_on_top(ppm), size_t(0));
+    {
+        quicksvg::plot_time_series<double> plot(0, 0.001, "Sine & cosine", "examples/raster_titled.ppm");
+        plot.add_dataset(v);
+        plot.write_all();
+    }
+    EXPECT_GT(white_on_top(slurp("examples/raster_titled.ppm")), size_t(50));
+
+    // A density heatmap embedded as a PNG in the SVG is drawn as cells in a bitmap:
+    std::vector<double> x(20000);
+    std::vector<double> y(x.size());
+    for (size_t i = 0; i < x.size(); ++i)
+    {
+        x[i] = std::cos(0.01*i)*i;
+        y[i] = std::sin(0.01*i)*i;
+    }
+    quicksvg::scatter_plot<double> scatter("", "examples/raster_density.ppm");
+    scatter.set_density(4, true);
+    scatter.add_dataset(x, y);
+    scatter.write_all();
+    std::string density = slurp("examples/raster_density.ppm");
+    ASSERT_EQ(density.substr(0, header.size()), header);
+    size_t heat = 0;
+    for (size_t i = header.size(); i < density.size(); i += 3)
+    {
+        unsigned char r = density[i];
+        unsigned char g = density[i+1];
+        unsigned char b = density[i+2];
+        // Neither black nor a gray of the axes and gridlines:
+        heat += !(r == g && g == b);
+    }
+    EXPECT_GT(heat, size_t(5000));
+}
+
+TEST(Canvas, html_output)
+{
+    std::vector<double> v(200000);
+    for (size_t i = 0; i < v.size(); ++i)
+    {
+        v[i] = std::sin(0.0001*i) + 0.01*std::sin(0.37*i);
+    }
+    for (std::string extension : {".svg", ".html"})
+    {
+        quicksvg::plot_time_series<double> plot(0, 0.001, "sine", "examples/canvas_sine" + extension);
+        plot.add_dataset(v);
+        plot.write_all();
+    }
+    std::string svg = slurp("examples/canvas_sine.svg");
+    std::string html = slurp("examples/canvas_sine.html");
+    EXPECT_EQ(html.find("<circle"), std::string::npos);
+    EXPECT_NE(html.find("<canvas width='1100' height='679'"), std::string::npos);
+    // Evenly spaced samples store only y, at 4 bytes (in base64, 16/3) per sample; the axes are the same as in the SVG:
+    EXPECT_LT(html.size(), size_t(5.5*v.size()));
+    EXPECT_GT(html.size(), size_t(5.3*v.size()));
+    std::string axes = svg.substr(svg.find("<svg"), svg.find("<path") - svg.find("<svg"));
+    EXPECT_NE(html.find(axes), std::string::npos);
+
+    std::vector<double> x(50000);
+    std::vector<double> y(x.size());
+    for (size_t i = 0; i < x.size(); ++i)
+    {
+        x[i] = std::cos(0.01*i)*i;
+        y[i] = std::sin(0.01*i)*i;
+    }
+    quicksvg::scatter_plot<double> scatter("spiral", "examples/canvas_spiral.html");
+    scatter.add_dataset(x, y, true);
+    scatter.write_all();
+    html = slurp("examples/canvas_spiral.html");
+    EXPECT_LT(html.size(), size_t(11*x.size()));
+    EXPECT_NE(html.find("l:1, c:'orange'"), std::string::npos);
+
+    auto fhi = [](boost::multiprecision::cpp_bin_float_50 x) { return boost::math::tgamma(x); };
+    auto flo = [](double x) { return boost::math::tgamma(x); };
+    quicksvg::ulp_plot<decltype(fhi), boost::multiprecision::cpp_bin_float_50, double> ulp(fhi, 1.0, 10.0, true, 300, 12);
+    ulp.add_fn(flo);
+    ulp.write("examples/canvas_ulp.html");
+    html = slurp("examples/canvas_ulp.html");
+    EXPECT_EQ(html.find("<circle"), std::string::npos);
+    EXPECT_NE(html.find("arrays[l.x]"), std::string::npos);
+}
 
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);